@@ -0,0 +1,138 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * arena_bench.c - Compares giving a round of short lived allocations back one
+ * by one with ufree against dropping all of them with uarena_reset. Each
+ * round allocates what a trace allocates, as a request handler would, and
+ * then releases everything at once.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+
+#define DEFAULT_ROUNDS 20
+
+/* The best round of one mode */
+typedef struct {
+    uint64_t round_ns;          /* allocating and releasing */
+    uint64_t release_ns;        /* releasing alone */
+} result_t;
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: arena_bench [-h] [-n rounds] file\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n rounds  Rounds to run of each mode, the best is kept (default %d).\n", DEFAULT_ROUNDS);
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/*
+ * run_round - Replays the allocations of the trace from arena, or from the
+ * umalloc heap if arena is NULL. Frees in the trace are skipped, since every
+ * payload lives to the end of the round, and reallocs get a new payload with
+ * the old one copied in. The round ends by freeing every payload with ufree,
+ * or by resetting the arena.
+ */
+static void run_round(trace_t *trace, uarena_t *arena, result_t *best) {
+    memset(trace->blocks, 0, trace->num_ids * sizeof(allocated_block_t));
+    uint64_t start = now_ns();
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        traceop_t op = trace->ops[curr_op];
+        allocated_block_t *block = &trace->blocks[op.index];
+        if (op.type == ALLOC) {
+            block->payload = uarena_malloc(arena, op.size);
+        } else if (op.type == REALLOC) {
+            if (arena == NULL) {
+                block->payload = urealloc(block->payload, op.size);
+            } else {
+                void *payload = uarena_malloc(arena, op.size);
+                if (block->payload != NULL) {
+                    memcpy(payload, block->payload, (block->block_size < op.size) ? block->block_size : op.size);
+                }
+                block->payload = payload;
+            }
+        } else {
+            continue;
+        }
+        if (block->payload == NULL) {
+            appl_error("Allocation failed.");
+        }
+        block->block_size = op.size;
+    }
+
+    uint64_t release = now_ns();
+    if (arena == NULL) {
+        for (size_t id = 0; id < trace->num_ids; id++) {
+            ufree(trace->blocks[id].payload);
+        }
+    } else {
+        uarena_reset(arena);
+    }
+    uint64_t end = now_ns();
+
+    if (best->round_ns == 0 || end - start < best->round_ns) {
+        best->round_ns = end - start;
+        best->release_ns = end - release;
+    }
+}
+
+int main(int argc, char **argv) {
+    char c;
+    int rounds = DEFAULT_ROUNDS;
+
+    while ((c = getopt(argc, argv, "hn:")) != EOF) {
+        switch (c) {
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        appl_error("No File parameter provided.");
+    }
+    if (rounds < 1) {
+        usage();
+        appl_error("Round count must be positive.");
+    }
+
+    trace_t *trace = read_trace(argv[optind], 0);
+    if (uinit() == -1) {
+        appl_error("uinit failed.");
+    }
+    uarena_t *arena = uarena_create();
+    if (arena == NULL) {
+        appl_error("uarena_create failed.");
+    }
+
+    result_t heap = {0}, bulk = {0};
+    for (int round = 0; round < rounds; round++) {
+        run_round(trace, NULL, &heap);
+        run_round(trace, arena, &bulk);
+    }
+    uarena_destroy(arena);
+
+    printf("%-14s %12s %14s %12s\n", "release", "round (us)", "release (us)", "ops/ms");
+    printf("%-14s %12.1f %14.1f %12.0f\n", "ufree", heap.round_ns / 1000.0, heap.release_ns / 1000.0,
+           trace->num_ops * 1e6 / heap.round_ns);
+    printf("%-14s %12.1f %14.1f %12.0f\n", "uarena_reset", bulk.round_ns / 1000.0, bulk.release_ns / 1000.0,
+           trace->num_ops * 1e6 / bulk.round_ns);
+
+    free_trace(trace);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * backend.c - The table of allocators a trace can be replayed on: umalloc,
+ * the system malloc, a bump allocator that never reuses memory, the upper
+ * bound on speed, and a perfect fit oracle that holds exactly the live bytes,
+ * the upper bound on utilization.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "csbrk.h"
+#include "backend.h"
+#include <malloc.h>
+#include <sys/mman.h>
+
+extern size_t sbrk_bytes;
+extern size_t held_bytes;
+
+/*
+ * Both the bump allocator and the oracle keep the payload size in a header
+ * of this many bytes, so that payloads stay aligned like umalloc's.
+ */
+#define SIZE_HEADER ALIGNMENT
+#define BUMP_MIN_CHUNK (64 * 1024)
+#define BUMP_MAX_CHUNK (4 * 1024 * 1024)
+
+static size_t umalloc_held(void) {
+    return held_bytes;
+}
+
+static size_t umalloc_peak(void) {
+    return sbrk_bytes;
+}
+
+/*
+ * The harness allocates the trace with the same malloc, so the system backend
+ * counts only what it holds beyond what was held at init.
+ */
+static size_t system_baseline;
+
+/*
+ * system_mallinfo - the main arena grown through sbrk, less the free top
+ * chunk it keeps in reserve, and the chunks mapped on their own.
+ */
+static size_t system_mallinfo(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.arena - info.keepcost + info.hblkhd;
+}
+
+static int system_init(void) {
+    system_baseline = system_mallinfo();
+    return 0;
+}
+
+/*
+ * system_held - walks the bins, so it is only called outside timed replays.
+ */
+static size_t system_held(void) {
+    size_t held = system_mallinfo();
+    return (held > system_baseline) ? held - system_baseline : 0;
+}
+
+/*
+ * The bump allocator carves payloads from chunks that double in size from
+ * BUMP_MIN_CHUNK to BUMP_MAX_CHUNK, or are as large as one request needs.
+ * They are populated up front, since every byte of them is going to be
+ * touched, and faulting them in at once is cheaper than page by page. Each
+ * chunk starts with a link to the chunk before it and its length, so
+ * bump_init can unmap them all.
+ */
+typedef struct bump_chunk_struct {
+    struct bump_chunk_struct *prev;
+    size_t length;
+} bump_chunk_t;
+
+static bump_chunk_t *bump_chunks;
+static char *bump_next;
+static char *bump_end;
+static size_t bump_bytes;
+static size_t bump_chunk_size;
+static char *bump_last;         /* the latest payload, which can grow in place */
+
+static int bump_init(void) {
+    while (bump_chunks != NULL) {
+        bump_chunk_t *prev = bump_chunks->prev;
+        munmap(bump_chunks, bump_chunks->length);
+        bump_chunks = prev;
+    }
+    bump_next = bump_end = bump_last = NULL;
+    bump_bytes = 0;
+    bump_chunk_size = BUMP_MIN_CHUNK;
+    return 0;
+}
+
+static void *bump_malloc(size_t size) {
+    size_t needed = SIZE_HEADER + ALIGN(size);
+    if (needed > bump_end - bump_next) {
+        size_t length = ALIGN(sizeof(bump_chunk_t)) + needed;
+        length = (length < bump_chunk_size) ? bump_chunk_size : (length + PAGESIZE - 1) & ~(PAGESIZE - 1);
+        bump_chunk_t *chunk = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (chunk == MAP_FAILED) {
+            return NULL;
+        }
+        chunk->prev = bump_chunks;
+        chunk->length = length;
+        bump_chunks = chunk;
+        bump_next = (char *) chunk + ALIGN(sizeof(bump_chunk_t));
+        bump_end = (char *) chunk + length;
+        bump_bytes += length;
+        bump_chunk_size = (bump_chunk_size < BUMP_MAX_CHUNK) ? 2 * bump_chunk_size : BUMP_MAX_CHUNK;
+    }
+    *(size_t *) bump_next = size;
+    bump_last = bump_next + SIZE_HEADER;
+    bump_next += needed;
+    return bump_last;
+}
+
+static void bump_free(void *ptr) {
+}
+
+static void *bump_realloc(void *ptr, size_t size) {
+    if (ptr != NULL && ptr == bump_last && ALIGN(size) <= bump_end - bump_last) {
+        *(size_t *) (bump_last - SIZE_HEADER) = size;
+        bump_next = bump_last + ALIGN(size);
+        return ptr;
+    }
+    void *payload = bump_malloc(size);
+    if (ptr != NULL && payload != NULL) {
+        size_t old_size = *(size_t *) ((char *) ptr - SIZE_HEADER);
+        memcpy(payload, ptr, (old_size < size) ? old_size : size);
+    }
+    return payload;
+}
+
+static size_t bump_held(void) {
+    return bump_bytes;
+}
+
+/*
+ * The oracle stores its payloads in the system malloc, but counts only the
+ * bytes asked for as held: no allocator can hold less and still keep every
+ * live payload, so its peak is the best footprint the trace allows.
+ */
+static size_t oracle_live;
+static size_t oracle_max;
+
+static int oracle_init(void) {
+    oracle_live = 0;
+    oracle_max = 0;
+    return 0;
+}
+
+static void *oracle_malloc(size_t size) {
+    char *block = malloc(SIZE_HEADER + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t *) block = size;
+    oracle_live += size;
+    oracle_max = (oracle_live > oracle_max) ? oracle_live : oracle_max;
+    return block + SIZE_HEADER;
+}
+
+static void oracle_free(void *ptr) {
+    if (ptr != NULL) {
+        char *block = (char *) ptr - SIZE_HEADER;
+        oracle_live -= *(size_t *) block;
+        free(block);
+    }
+}
+
+static void *oracle_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return oracle_malloc(size);
+    }
+    char *block = (char *) ptr - SIZE_HEADER;
+    size_t old_size = *(size_t *) block;
+    block = realloc(block, SIZE_HEADER + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t *) block = size;
+    oracle_live += size - old_size;
+    oracle_max = (oracle_live > oracle_max) ? oracle_live : oracle_max;
+    return block + SIZE_HEADER;
+}
+
+static size_t oracle_held(void) {
+    return oracle_live;
+}
+
+static size_t oracle_peak(void) {
+    return oracle_max;
+}
+
+const backend_t backends[] = {
+    {"umalloc", "the allocator under test", uinit, umalloc, ufree, urealloc, umalloc_held, umalloc_peak,
+     true},
+    {"system", "the C library malloc", system_init, malloc, free, realloc, system_held, NULL, false},
+    {"bump", "never reuses memory, the upper bound on speed", bump_init, bump_malloc, bump_free, bump_realloc,
+     bump_held, bump_held, false},
+    {"oracle", "holds only the live bytes, the upper bound on utilization", oracle_init, oracle_malloc,
+     oracle_free, oracle_realloc, oracle_held, oracle_peak, false},
+};
+const int num_backends = sizeof(backends) / sizeof(backends[0]);
+
+/*
+ * find_backend - The backend called name, or NULL if there is none.
+ */
+const backend_t *find_backend(const char *name) {
+    for (int i = 0; i < num_backends; i++) {
+        if (strcmp(backends[i].name, name) == 0) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,33 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * backend.h - The allocators runner and performance can replay a trace on.
+ * umalloc is the one under test; the rest are there to measure it against.
+ **************************************************************************/
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * backend_t - One allocator behind the umalloc interface. held is the bytes
+ * it holds from the system right now. peak is the most it ever held at once,
+ * or NULL when the allocator cannot tell, in which case the harness samples
+ * held after every op. native is set only for umalloc itself, whose memory
+ * comes from csbrk and whose heap check_heap, utrim and ustats know.
+ */
+typedef struct {
+    const char *name;
+    const char *description;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    size_t (*held)(void);
+    size_t (*peak)(void);
+    bool native;
+} backend_t;
+
+extern const backend_t backends[];
+extern const int num_backends;
+
+const backend_t *find_backend(const char *name);
@@ -0,0 +1,520 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * bench.c - Benchmarks the umalloc package on a set of traces and reports the
+ * spread of the results as JSON, or compares two such reports and flags the
+ * traces that got significantly slower.
+ **************************************************************************/
+
+#define _GNU_SOURCE /* for sched_setaffinity */
+#include "umalloc.h"
+#include "support.h"
+#include <math.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ITERATIONS 20
+#define DEFAULT_WARMUP 3
+#define DEFAULT_ALPHA 0.05
+#define DEFAULT_THRESHOLD 1.0   /* percent */
+
+/*
+ * One timed iteration of one trace, written by the child that ran it into
+ * memory shared with the parent. Warm-up iterations are kept in the same
+ * array but left out of the statistics.
+ */
+typedef struct {
+    uint64_t init_ns;       /* uinit */
+    uint64_t replay_ns;     /* every op of the trace */
+    bool done;              /* the child got to the end */
+} sample_t;
+
+/* The statistics of one measurement over the timed iterations */
+typedef struct {
+    int n;
+    double mean;
+    double median;
+    double stddev;
+    double ci_low, ci_high; /* 95% confidence interval of the mean */
+} summary_t;
+
+static int iterations = DEFAULT_ITERATIONS;
+static int warmup = DEFAULT_WARMUP;
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: bench [-h] [-n iterations] [-w warmup] [-j jobs] [-c cpu] [-o file] trace...\n");
+    fprintf(stderr, "       bench -C [-a alpha] [-t percent] base.json new.json\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n iterations  Timed iterations of each trace, each in a fresh child (default %d).\n",
+            DEFAULT_ITERATIONS);
+    fprintf(stderr, "\t-w warmup      Iterations run first and thrown away (default %d).\n", DEFAULT_WARMUP);
+    fprintf(stderr, "\t-j jobs        Traces to run at once, each pinned to its own CPU (default 1).\n");
+    fprintf(stderr, "\t-c cpu         The first CPU to pin to (default 0).\n");
+    fprintf(stderr, "\t-o file        Write the JSON report to file instead of stdout.\n");
+    fprintf(stderr, "\t-C             Compare two reports, exit 1 if any trace regressed.\n");
+    fprintf(stderr, "\t-a alpha       Significance level of the comparison (default %.2f).\n", DEFAULT_ALPHA);
+    fprintf(stderr, "\t-t percent     Smallest slowdown of the mean reported (default %.1f).\n", DEFAULT_THRESHOLD);
+    fprintf(stderr, "\t-h             Print this message.\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/*
+ * pin_cpu - Keeps this process, and every child it forks, on one CPU.
+ */
+static void pin_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        perror("sched_setaffinity");
+    }
+}
+
+/*
+ * run_iteration - The body of one child: replays the trace on a heap nobody
+ * has touched, as performance does, sbrk calls from another caller included,
+ * and records how long uinit and the replay took. The block array is written
+ * once first, so the copy on write faults of the fork are not timed.
+ */
+static void run_iteration(trace_t *trace, sample_t *sample) {
+    memset(trace->blocks, 0, trace->num_ids * sizeof(allocated_block_t));
+
+    uint64_t start = now_ns();
+    if (uinit() == -1) {
+        _exit(1);
+    }
+    uint64_t init_end = now_ns();
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        if (op.type == ALLOC) {
+            trace->blocks[op.index].payload = umalloc(op.size);
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = urealloc(trace->blocks[op.index].payload, op.size);
+        } else {
+            ufree(trace->blocks[op.index].payload);
+        }
+    }
+    uint64_t end = now_ns();
+
+    sample->init_ns = init_end - start;
+    sample->replay_ns = end - init_end;
+    sample->done = true;
+    _exit(0);
+}
+
+/*
+ * run_trace - The body of the worker for one trace: forks a child for every
+ * warm-up and timed iteration in turn, so each starts from the same clean
+ * process. Stops at the first child that fails, leaving the rest of samples
+ * not done.
+ */
+static void run_trace(char *filename, sample_t *samples) {
+    trace_t *trace = read_trace(filename, 0);
+    for (int i = 0; i < warmup + iterations; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            break;
+        } else if (pid == 0) {
+            run_iteration(trace, &samples[i]);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !samples[i].done) {
+            fprintf(stderr, "%s: iteration %d failed\n", filename, i);
+            break;
+        }
+    }
+    free_trace(trace);
+}
+
+/*
+ * run_traces - Runs the workers for every trace, at most jobs at a time. Each
+ * running worker holds a slot, and slot s is pinned to CPU first_cpu + s, so
+ * traces running at once never share a CPU and a trace always runs alone on
+ * its CPU.
+ */
+static void run_traces(char **filenames, int num_traces, sample_t *samples, int jobs, int first_cpu) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pid_t *slots = calloc(jobs, sizeof(pid_t));
+    assert(slots != NULL);
+    int running = 0;
+
+    for (int t = 0; t < num_traces || running > 0; ) {
+        if (t < num_traces && running < jobs) {
+            int slot = 0;
+            while (slots[slot] != 0) {
+                slot++;
+            }
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == -1) {
+                appl_error("fork failed.");
+            } else if (pid == 0) {
+                pin_cpu((first_cpu + slot) % num_cpus);
+                run_trace(filenames[t], samples + (size_t) t * (warmup + iterations));
+                exit(0);
+            }
+            slots[slot] = pid;
+            running++;
+            t++;
+            continue;
+        }
+        pid_t pid = wait(NULL);
+        for (int slot = 0; slot < jobs; slot++) {
+            if (slots[slot] == pid) {
+                slots[slot] = 0;
+                running--;
+            }
+        }
+    }
+    free(slots);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double left = *(double *) a, right = *(double *) b;
+    return (left > right) - (left < right);
+}
+
+/*
+ * incomplete_beta_fraction - The continued fraction of the regularized
+ * incomplete beta function, by the modified Lentz method.
+ */
+static double incomplete_beta_fraction(double a, double b, double x) {
+    const double tiny = 1e-300;
+    double c = 1.0, d = 1.0 - (a + b) * x / (a + 1.0);
+    d = 1.0 / ((fabs(d) < tiny) ? tiny : d);
+    double result = d;
+    for (int m = 1; m <= 300; m++) {
+        for (int odd = 0; odd < 2; odd++) {
+            double numerator = odd ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                                   : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1.0 + numerator * d;
+            d = 1.0 / ((fabs(d) < tiny) ? tiny : d);
+            c = 1.0 + numerator / c;
+            c = (fabs(c) < tiny) ? tiny : c;
+            result *= c * d;
+            if (odd && fabs(c * d - 1.0) < 1e-12) {
+                return result;
+            }
+        }
+    }
+    return result;
+}
+
+/*
+ * incomplete_beta - The regularized incomplete beta function I_x(a, b).
+ */
+static double incomplete_beta(double a, double b, double x) {
+    if (x <= 0.0 || x >= 1.0) {
+        return (x <= 0.0) ? 0.0 : 1.0;
+    }
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1.0 - x));
+    if (x < (a + 1.0) / (a + b + 2.0)) {
+        return front * incomplete_beta_fraction(a, b, x) / a;
+    }
+    return 1.0 - front * incomplete_beta_fraction(b, a, 1.0 - x) / b;
+}
+
+/*
+ * t_two_sided - The chance of a Student's t with df degrees of freedom being
+ * at least |t| away from 0.
+ */
+static double t_two_sided(double t, double df) {
+    return incomplete_beta(df / 2.0, 0.5, df / (df + t * t));
+}
+
+/*
+ * t_critical - The t for which t_two_sided is alpha, by bisection.
+ */
+static double t_critical(double alpha, double df) {
+    double low = 0.0, high = 1000.0;
+    for (int i = 0; i < 100; i++) {
+        double mid = (low + high) / 2.0;
+        if (t_two_sided(mid, df) > alpha) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return (low + high) / 2.0;
+}
+
+/*
+ * summarize - The statistics of the timed samples of one trace, reading the
+ * uinit time if init is set and the replay time otherwise. Stops at the first
+ * sample not done.
+ */
+static summary_t summarize(sample_t *samples, bool init) {
+    summary_t summary = {0};
+    double *values = malloc(iterations * sizeof(double));
+    assert(values != NULL);
+    for (int i = 0; i < iterations && samples[warmup + i].done; i++) {
+        sample_t *sample = &samples[warmup + i];
+        values[summary.n++] = init ? sample->init_ns : sample->replay_ns;
+    }
+    if (summary.n == 0) {
+        free(values);
+        return summary;
+    }
+
+    double sum = 0.0, squares = 0.0;
+    for (int i = 0; i < summary.n; i++) {
+        sum += values[i];
+    }
+    summary.mean = sum / summary.n;
+    for (int i = 0; i < summary.n; i++) {
+        squares += (values[i] - summary.mean) * (values[i] - summary.mean);
+    }
+    summary.stddev = (summary.n > 1) ? sqrt(squares / (summary.n - 1)) : 0.0;
+
+    qsort(values, summary.n, sizeof(double), compare_doubles);
+    summary.median = (summary.n % 2) ? values[summary.n / 2]
+                                     : (values[summary.n / 2 - 1] + values[summary.n / 2]) / 2.0;
+    double half = (summary.n > 1) ? t_critical(0.05, summary.n - 1) * summary.stddev / sqrt(summary.n) : 0.0;
+    summary.ci_low = summary.mean - half;
+    summary.ci_high = summary.mean + half;
+    free(values);
+    return summary;
+}
+
+static void print_summary(FILE *out, char *name, summary_t *summary) {
+    fprintf(out, "\"%s\": {\"n\": %d, \"mean\": %.1f, \"median\": %.1f, \"stddev\": %.1f, \"ci95\": [%.1f, %.1f]}",
+            name, summary->n, summary->mean, summary->median, summary->stddev, summary->ci_low, summary->ci_high);
+}
+
+/*
+ * print_report - Writes the statistics of every trace as JSON, one trace per
+ * line so that compare_reports can read it back line by line. ops_per_ms is
+ * the number of ops over the mean replay time, uinit left out.
+ */
+static void print_report(FILE *out, char **filenames, int num_traces, sample_t *samples, int jobs, int first_cpu) {
+    fprintf(out, "{\"iterations\": %d, \"warmup\": %d, \"jobs\": %d, \"cpu\": %d, \"traces\": [\n",
+            iterations, warmup, jobs, first_cpu);
+    for (int t = 0; t < num_traces; t++) {
+        sample_t *trace_samples = samples + (size_t) t * (warmup + iterations);
+        trace_t *trace = read_trace(filenames[t], 0);
+        summary_t init = summarize(trace_samples, true);
+        summary_t replay = summarize(trace_samples, false);
+        fprintf(out, "  {\"trace\": \"%s\", \"ops\": %d, \"passed\": %s, ", filenames[t], trace->num_ops,
+                (replay.n == iterations) ? "true" : "false");
+        print_summary(out, "uinit_ns", &init);
+        fprintf(out, ", ");
+        print_summary(out, "replay_ns", &replay);
+        fprintf(out, ", \"ops_per_ms\": %.1f}%s\n", (replay.n > 0) ? trace->num_ops * 1e6 / replay.mean : 0.0,
+                (t + 1 < num_traces) ? "," : "");
+        free_trace(trace);
+    }
+    fprintf(out, "]}\n");
+}
+
+/*
+ * One trace read back from a report, with what the comparison needs. Only
+ * reports written by print_report are understood.
+ */
+typedef struct {
+    char trace[MAXLINE];
+    summary_t init;
+    summary_t replay;
+} report_entry_t;
+
+static bool parse_summary(char *line, char *name, summary_t *summary) {
+    char key[MAXLINE];
+    snprintf(key, MAXLINE, "\"%s\": {", name);
+    char *found = strstr(line, key);
+    return found != NULL && sscanf(found + strlen(key), "\"n\": %d, \"mean\": %lf, \"median\": %lf, \"stddev\": %lf",
+                                   &summary->n, &summary->mean, &summary->median, &summary->stddev) == 4;
+}
+
+/*
+ * read_report - Reads the traces of a report into a new array and returns how
+ * many there are.
+ */
+static int read_report(char *filename, report_entry_t **entries) {
+    FILE *in = fopen(filename, "r");
+    if (in == NULL) {
+        perror(filename);
+        appl_error("Could not open the report.");
+    }
+    char line[4 * MAXLINE];
+    int count = 0, capacity = 16;
+    *entries = malloc(capacity * sizeof(report_entry_t));
+    assert(*entries != NULL);
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char *trace = strstr(line, "{\"trace\": \"");
+        if (trace == NULL) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *entries = realloc(*entries, capacity * sizeof(report_entry_t));
+            assert(*entries != NULL);
+        }
+        report_entry_t *entry = &(*entries)[count];
+        if (sscanf(trace, "{\"trace\": \"%1023[^\"]\"", entry->trace) != 1 ||
+            !parse_summary(line, "uinit_ns", &entry->init) || !parse_summary(line, "replay_ns", &entry->replay)) {
+            fprintf(stderr, "%s: could not read %s", filename, line);
+            appl_error("Malformed report.");
+        }
+        count++;
+    }
+    fclose(in);
+    return count;
+}
+
+/*
+ * compare_summaries - Prints one row comparing a measurement of a trace in
+ * both reports, and returns whether it regressed: the new mean is at least
+ * threshold percent above the base one, and Welch's t-test, which does not
+ * assume the two builds vary alike, finds the difference significant at
+ * alpha.
+ */
+static bool compare_summaries(char *trace, char *name, summary_t *base, summary_t *new, double alpha,
+                              double threshold) {
+    if (base->n < 2 || new->n < 2) {
+        printf("%-28s %-7s %12s\n", trace, name, "no samples");
+        return false;
+    }
+    double base_var = base->stddev * base->stddev / base->n;
+    double new_var = new->stddev * new->stddev / new->n;
+    double change = 100.0 * (new->mean - base->mean) / base->mean;
+    double p = 1.0;
+    if (base_var + new_var > 0.0) {
+        double t = (new->mean - base->mean) / sqrt(base_var + new_var);
+        double df = (base_var + new_var) * (base_var + new_var) /
+                    (base_var * base_var / (base->n - 1) + new_var * new_var / (new->n - 1));
+        p = t_two_sided(t, df);
+    } else if (new->mean != base->mean) {
+        p = 0.0;
+    }
+    bool significant = p < alpha;
+    bool regressed = significant && change >= threshold;
+    printf("%-28s %-7s %12.1f %12.1f %+8.2f%% %10.4f  %s\n", trace, name, base->mean / 1000.0, new->mean / 1000.0,
+           change, p, regressed ? "REGRESSION" : (significant && change <= -threshold) ? "faster" : "");
+    return regressed;
+}
+
+/*
+ * compare_reports - Compares the uinit and replay times of every trace found
+ * in both reports. Returns 1 if any regressed, 0 otherwise.
+ */
+static int compare_reports(char *base_file, char *new_file, double alpha, double threshold) {
+    report_entry_t *base, *new;
+    int num_base = read_report(base_file, &base);
+    int num_new = read_report(new_file, &new);
+    int regressions = 0;
+
+    printf("%-28s %-7s %12s %12s %9s %10s\n", "trace", "", "base (us)", "new (us)", "change", "p");
+    for (int i = 0; i < num_new; i++) {
+        report_entry_t *match = NULL;
+        for (int j = 0; j < num_base && match == NULL; j++) {
+            if (strcmp(base[j].trace, new[i].trace) == 0) {
+                match = &base[j];
+            }
+        }
+        if (match == NULL) {
+            printf("%-28s not in %s\n", new[i].trace, base_file);
+            continue;
+        }
+        regressions += compare_summaries(new[i].trace, "uinit", &match->init, &new[i].init, alpha, threshold);
+        regressions += compare_summaries(new[i].trace, "replay", &match->replay, &new[i].replay, alpha, threshold);
+    }
+    printf("%d significant regression%s at alpha %.3g\n", regressions, (regressions == 1) ? "" : "s", alpha);
+
+    free(base);
+    free(new);
+    return regressions > 0;
+}
+
+int main(int argc, char **argv) {
+    char c;
+    int jobs = 1, first_cpu = 0;
+    bool compare = false;
+    double alpha = DEFAULT_ALPHA, threshold = DEFAULT_THRESHOLD;
+    char *output = NULL;
+
+    while ((c = getopt(argc, argv, "a:c:Chj:n:o:t:w:")) != EOF) {
+        switch (c) {
+        case 'a':
+            alpha = atof(optarg);
+            break;
+        case 'c':
+            first_cpu = atoi(optarg);
+            break;
+        case 'C':
+            compare = true;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (compare) {
+        if (argc - optind != 2) {
+            usage();
+            appl_error("Compare needs two reports.");
+        }
+        return compare_reports(argv[optind], argv[optind + 1], alpha, threshold);
+    }
+    if (optind >= argc) {
+        usage();
+        appl_error("No File parameter provided.");
+    }
+    if (iterations < 1 || warmup < 0 || jobs < 1 || first_cpu < 0) {
+        usage();
+        appl_error("Iterations and jobs must be positive.");
+    }
+
+    char **filenames = argv + optind;
+    int num_traces = argc - optind;
+    size_t length = (size_t) num_traces * (warmup + iterations) * sizeof(sample_t);
+    sample_t *samples = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED) {
+        appl_error("Could not map the samples.");
+    }
+    run_traces(filenames, num_traces, samples, jobs, first_cpu);
+
+    FILE *out = (output == NULL) ? stdout : fopen(output, "w");
+    if (out == NULL) {
+        perror(output);
+        appl_error("Could not open the output file.");
+    }
+    print_report(out, filenames, num_traces, samples, jobs, first_cpu);
+    if (out != stdout) {
+        fclose(out);
+    }
+    munmap(samples, length);
+    return 0;
+}
@@ -0,0 +1,586 @@
+#include "buddy.h"
+#include "csbrk.h"
+#include "ansicolors.h"
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+const char author[] = ANSI_BOLD ANSI_COLOR_RED "Christopher Carrasco cc66496" ANSI_RESET;
+
+// heads of the free lists, one per block size from BUDDY_MIN_SIZE up
+buddy_block_t *buddy_lists[BUDDY_ORDERS];
+// bit i is set when buddy_lists[i] is non-empty
+unsigned int buddy_bitmap;
+// keeps count of the number of free blocks that should be in the free lists
+unsigned long num_free_blocks;
+// every block mapped outside the heap
+large_block_t *mapped_blocks;
+// every run of contiguous heap memory, newest first
+buddy_chunk_t *buddy_chunks;
+
+// the heap grows through csbrk, or through chsbrk's huge page region when
+// built with UMALLOC_HUGE
+#ifdef UMALLOC_HUGE
+#define heap_sbrk chsbrk
+#define heap_break() chsbrk(0)
+#else
+#define heap_sbrk csbrk
+#define heap_break() sbrk(0)
+#endif
+
+#ifdef UMALLOC_STATS
+static ustats_t counted;
+#define STAT_ADD(field, n) (counted.field += (n))
+#define STAT_SUB(field, n) (counted.field -= (n))
+#else
+#define STAT_ADD(field, n) ((void) 0)
+#define STAT_SUB(field, n) ((void) 0)
+#endif
+
+/*
+ * buddy_order - the free list of a block of size bytes, a power of two.
+ */
+int buddy_order(size_t size) {
+    assert((size & (size - 1)) == 0 && size >= BUDDY_MIN_SIZE && size <= BUDDY_MAX_SIZE);
+    return __builtin_ctzl(size) - BUDDY_MIN_ORDER;
+}
+
+/*
+ * block_size - the smallest block that holds a payload of size bytes.
+ */
+static size_t block_size(size_t size) {
+    size += BUDDY_HEADER_SIZE;
+    if (size <= BUDDY_MIN_SIZE) {
+        return BUDDY_MIN_SIZE;
+    }
+    return 1UL << (64 - __builtin_clzl(size - 1));
+}
+
+/*
+ * block_offset - where block sits in its chunk. Blocks are aligned to their
+ * size relative to the chunk's start, not to their address, so the layout of
+ * the heap does not depend on where the break happens to begin.
+ */
+static size_t block_offset(buddy_block_t *block) {
+    return (char *) block - block->chunk->start;
+}
+
+/*
+ * get_buddy - the block that block of size bytes splits from or merges with.
+ */
+static buddy_block_t *get_buddy(buddy_block_t *block, size_t size) {
+    return (buddy_block_t *) (block->chunk->start + (block_offset(block) ^ size));
+}
+
+/*
+ * is_free_buddy - returns true if the buddy of a block of size bytes is a
+ * free block of the same size, so the two can merge. Only a buddy that lies
+ * in the block's chunk is read.
+ */
+bool is_free_buddy(buddy_block_t *block, size_t size) {
+    buddy_chunk_t *chunk = block->chunk;
+    char *parent = chunk->start + (block_offset(block) & ~(2 * size - 1));
+    if (parent + 2 * size > chunk->end) {
+        return false;
+    }
+    return get_buddy(block, size)->block_size_alloc == size;
+}
+
+/*
+ * push_block - marks a block of size bytes in chunk free and pushes it onto
+ * its list.
+ */
+static void push_block(buddy_block_t *block, size_t size, buddy_chunk_t *chunk) {
+    int order = buddy_order(size);
+    block->block_size_alloc = size;
+    block->chunk = chunk;
+    block->prev = NULL;
+    block->next = buddy_lists[order];
+    if (block->next != NULL) {
+        block->next->prev = block;
+    }
+    buddy_lists[order] = block;
+    buddy_bitmap |= 1U << order;
+    num_free_blocks++;
+}
+
+/*
+ * unlink_block - takes a free block off its list.
+ */
+static void unlink_block(buddy_block_t *block) {
+    int order = buddy_order(block->block_size_alloc);
+    if (block->prev == NULL) {
+        buddy_lists[order] = block->next;
+    } else {
+        block->prev->next = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    if (buddy_lists[order] == NULL) {
+        buddy_bitmap &= ~(1U << order);
+    }
+    num_free_blocks--;
+}
+
+/*
+ * release_block - frees a block of size bytes, merging it with its buddy for
+ * as long as the buddy is free too.
+ */
+static void release_block(buddy_block_t *block, size_t size) {
+    buddy_chunk_t *chunk = block->chunk;
+    while (size < BUDDY_MAX_SIZE && is_free_buddy(block, size)) {
+        buddy_block_t *buddy = get_buddy(block, size);
+        unlink_block(buddy);
+        STAT_ADD(coalesces, 1);
+        block = (buddy < block) ? buddy : block;
+        size *= 2;
+    }
+    push_block(block, size, chunk);
+}
+
+/*
+ * release_range - frees the memory of chunk from start to end, both multiples
+ * of BUDDY_MIN_SIZE from the chunk's start, as the largest blocks that are
+ * aligned to their size, merging them with free buddies.
+ */
+static void release_range(buddy_chunk_t *chunk, char *start, char *end) {
+    while (start < end) {
+        size_t offset = start - chunk->start;
+        size_t size = offset & -offset;
+        if (size == 0 || size > BUDDY_MAX_SIZE) {
+            size = BUDDY_MAX_SIZE;
+        }
+        while (start + size > end) {
+            size /= 2;
+        }
+        buddy_block_t *block = (buddy_block_t *) start;
+        block->chunk = chunk;
+        release_block(block, size);
+        start += size;
+    }
+}
+
+/*
+ * align_up - rounds ptr up to a multiple of alignment, a power of two.
+ */
+static char *align_up(char *ptr, size_t alignment) {
+    return (char *) (((size_t) ptr + alignment - 1) & ~(alignment - 1));
+}
+
+/*
+ * grow_heap - extends the heap until it has a free block of at least size
+ * bytes. The new memory is padded up to a multiple of size from the chunk's
+ * start, and the padding is freed as smaller blocks. Memory that does not
+ * follow the newest chunk starts a chunk of its own. Returns false if csbrk
+ * fails.
+ */
+static bool grow_heap(size_t size) {
+    while ((buddy_bitmap >> buddy_order(size)) == 0) {
+        char *brk = heap_break();
+        buddy_chunk_t *chunk = buddy_chunks;
+        bool contiguous = chunk != NULL && chunk->end == brk;
+        char *start = contiguous ? brk : align_up(align_up(brk, sizeof(size_t)) + sizeof(buddy_chunk_t), BUDDY_MIN_SIZE);
+        char *base = contiguous ? chunk->start : start;
+        char *end = base + ((start - base + size - 1) & ~(size - 1)) + size;
+        if (end - brk > BUDDY_MAX_SIZE) {
+            end = (char *) ((size_t) (brk + BUDDY_MAX_SIZE) & ~(BUDDY_MIN_SIZE - 1));
+        }
+        char *result = heap_sbrk(end - brk);
+        if (result == NULL || result == (void *) -1) {
+            return false;
+        }
+        assert(result == brk);
+        STAT_ADD(extends, 1);
+        STAT_ADD(heap_bytes, end - brk);
+        if (!contiguous) {
+            chunk = (buddy_chunk_t *) align_up(brk, sizeof(size_t));
+            chunk->start = start;
+            chunk->next = buddy_chunks;
+            buddy_chunks = chunk;
+        }
+        chunk->end = end;
+        release_range(chunk, start, end);
+    }
+    return true;
+}
+
+/*
+ * alloc_block - takes a block of size bytes off the lists, splitting the
+ * smallest larger free block down to it. Returns NULL if the heap cannot grow.
+ */
+static buddy_block_t *alloc_block(size_t size) {
+    int order = buddy_order(size);
+    if ((buddy_bitmap >> order) == 0 && !grow_heap(size)) {
+        return NULL;
+    }
+    int found = __builtin_ctz(buddy_bitmap >> order) + order;
+    buddy_block_t *block = buddy_lists[found];
+    unlink_block(block);
+    // give back the upper halves until the block is size bytes
+    for (size_t cur = BUDDY_MIN_SIZE << found; cur > size; cur /= 2) {
+        push_block((buddy_block_t *) ((char *) block + cur / 2), cur / 2, block->chunk);
+        STAT_ADD(splits, 1);
+    }
+    block->block_size_alloc = size | 0x1;
+    return block;
+}
+
+/*
+ * shrink_block - cuts an allocated block down to size bytes, freeing the
+ * upper halves. Their buddies are the part kept, so they never merge.
+ */
+static void shrink_block(buddy_block_t *block, size_t size) {
+    for (size_t cur = block->block_size_alloc & ~0x1UL; cur > size; cur /= 2) {
+        push_block((buddy_block_t *) ((char *) block + cur / 2), cur / 2, block->chunk);
+        STAT_ADD(splits, 1);
+    }
+    block->block_size_alloc = size | 0x1;
+}
+
+/*
+ * grow_block - grows an allocated block in place to size bytes by merging it
+ * with its free buddies above it. Returns false, changing nothing, if a
+ * buddy on the way is allocated or the block is an upper half.
+ */
+static bool grow_block(buddy_block_t *block, size_t size) {
+    size_t old_size = block->block_size_alloc & ~0x1UL;
+    for (size_t cur = old_size; cur < size; cur *= 2) {
+        if ((block_offset(block) & cur) != 0 || !is_free_buddy(block, cur)) {
+            return false;
+        }
+    }
+    for (size_t cur = old_size; cur < size; cur *= 2) {
+        unlink_block(get_buddy(block, cur));
+        STAT_ADD(coalesces, 1);
+    }
+    block->block_size_alloc = size | 0x1;
+    return true;
+}
+
+/*
+ * get_large_block - returns the mapping of a payload, or NULL if the payload
+ * is in the heap. Both headers end in the size word, and only a mapped one
+ * has MAPPED set, since heap block sizes are powers of two of at least 32.
+ */
+static large_block_t *get_large_block(void *payload) {
+    buddy_block_t *header = (buddy_block_t *) ((char *) payload - BUDDY_HEADER_SIZE);
+    if (!(header->block_size_alloc & MAPPED)) {
+        return NULL;
+    }
+    return (large_block_t *) ((char *) payload - sizeof(large_block_t));
+}
+
+/*
+ * link_large_block - writes the header of a mapping of length bytes and
+ * pushes it onto the list of mapped blocks. Returns the payload.
+ */
+static void *link_large_block(large_block_t *large, size_t length) {
+    large->block.block_size_alloc = (length - sizeof(large_block_t)) | MAPPED | 0x1;
+    large->prev = NULL;
+    large->next = mapped_blocks;
+    if (mapped_blocks != NULL) {
+        mapped_blocks->prev = large;
+    }
+    mapped_blocks = large;
+    return large + 1;
+}
+
+/*
+ * unlink_large_block - takes a mapping off the list of mapped blocks, and
+ * returns its length.
+ */
+static size_t unlink_large_block(large_block_t *large) {
+    if (large->prev == NULL) {
+        mapped_blocks = large->next;
+    } else {
+        large->prev->next = large->next;
+    }
+    if (large->next != NULL) {
+        large->next->prev = large->prev;
+    }
+    return (large->block.block_size_alloc & ~(size_t) (ALIGNMENT - 1)) + sizeof(large_block_t);
+}
+
+/*
+ * mapped_length - the number of bytes to map for a payload of size bytes,
+ * which its callers keep at most PTRDIFF_MAX so the sum cannot overflow.
+ */
+static size_t mapped_length(size_t size) {
+    return (size + sizeof(large_block_t) + PAGESIZE - 1) & ~(size_t) (PAGESIZE - 1);
+}
+
+/*
+ * map_block - maps a payload of size bytes on its own. Returns NULL if the
+ * mapping fails or size is past PTRDIFF_MAX.
+ */
+static void *map_block(size_t size) {
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    size_t length = mapped_length(size);
+    large_block_t *large = cmmap(length);
+    return (large == NULL) ? NULL : link_large_block(large, length);
+}
+
+/*
+ * remap_block - resizes a mapping to hold size bytes, letting the kernel move
+ * it. Returns NULL, leaving the mapping as it was, if it cannot be resized or
+ * size is past PTRDIFF_MAX.
+ */
+static void *remap_block(large_block_t *large, size_t size) {
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    size_t old_length = unlink_large_block(large);
+    size_t length = mapped_length(size);
+    large_block_t *moved = (length == old_length) ? large : cmremap(large, old_length, length);
+    if (moved == NULL) {
+        link_large_block(large, old_length);
+        return NULL;
+    }
+    return link_large_block(moved, length);
+}
+
+/*
+ * unmap_block - gives a mapped block back to the OS.
+ */
+static void unmap_block(large_block_t *large) {
+    cmunmap(large, unlink_large_block(large));
+}
+
+/*
+ * payload_size - the number of bytes usable at an allocated payload.
+ */
+static size_t payload_size(void *payload) {
+    large_block_t *large = get_large_block(payload);
+    if (large != NULL) {
+        return large->block.block_size_alloc & ~(size_t) (ALIGNMENT - 1);
+    }
+    buddy_block_t *block = (buddy_block_t *) ((char *) payload - BUDDY_HEADER_SIZE);
+    return (block->block_size_alloc & ~0x1UL) - BUDDY_HEADER_SIZE;
+}
+
+int uinit() {
+    for (int order = 0; order < BUDDY_ORDERS; order++) {
+        buddy_lists[order] = NULL;
+    }
+    buddy_bitmap = 0;
+    num_free_blocks = 0;
+    mapped_blocks = NULL;
+#ifdef UMALLOC_STATS
+    memset(&counted, 0, sizeof(counted));
+#endif
+    buddy_chunks = NULL;
+    // an initial heap of 8192B, as umalloc.c starts with
+    if (!grow_heap(PAGESIZE * 2)) {
+        return -1;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * umalloc - allocates size bytes and returns a pointer to the allocated memory.
+ */
+void *umalloc(size_t size) {
+    void *payload;
+    if (size >= MMAP_THRESHOLD) {
+        payload = map_block(size);
+    } else {
+        buddy_block_t *block = alloc_block(block_size(size));
+        payload = (block == NULL) ? NULL : (char *) block + BUDDY_HEADER_SIZE;
+    }
+#ifdef UMALLOC_STATS
+    if (payload != NULL) {
+        STAT_ADD(allocs, 1);
+        STAT_ADD(bytes_live, payload_size(payload));
+    }
+#endif
+    return payload;
+}
+
+/*
+ * ufree - frees the memory space pointed to by ptr, which must have been
+ * returned by a previous call to umalloc. Heap blocks that are not allocated
+ * are ignored.
+ */
+void ufree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    large_block_t *large = get_large_block(ptr);
+    buddy_block_t *block = (buddy_block_t *) ((char *) ptr - BUDDY_HEADER_SIZE);
+    if (large == NULL && !(block->block_size_alloc & 0x1)) {
+        return;
+    }
+    STAT_ADD(frees, 1);
+    STAT_SUB(bytes_live, payload_size(ptr));
+    if (large != NULL) {
+        unmap_block(large);
+    } else {
+        release_block(block, block->block_size_alloc & ~0x1UL);
+    }
+}
+
+/*
+ * umalloc_usable_size - returns the number of bytes usable at ptr, which is at
+ * least the size it was allocated with, or 0 for NULL.
+ */
+size_t umalloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return payload_size(ptr);
+}
+
+/*
+ * ucalloc - allocates an array of nmemb elements of size bytes, all zeroed.
+ * Returns NULL if the total size overflows.
+ */
+void *ucalloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total) || total > PTRDIFF_MAX) {
+        return NULL;
+    }
+    void *ptr = umalloc(total);
+    if (ptr != NULL && get_large_block(ptr) == NULL) {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+/*
+ * urealloc - changes the size of the memory block pointed to by ptr to size
+ * bytes. A heap block keeps its place when the new size needs the same block
+ * size, a smaller one, or a larger one its free buddies can make up, and a
+ * mapped block is resized with mremap.
+ */
+void *urealloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return umalloc(size);
+    }
+    if (size == 0) {
+        ufree(ptr);
+        return NULL;
+    }
+
+    size_t old_size = payload_size(ptr);
+    large_block_t *large = get_large_block(ptr);
+    STAT_ADD(reallocs, 1);
+    if (large != NULL && size >= MMAP_THRESHOLD) {
+        void *moved = remap_block(large, size);
+        if (moved != NULL) {
+            STAT_ADD(bytes_live, payload_size(moved) - old_size);
+            return moved;
+        }
+    } else if (large == NULL && size < MMAP_THRESHOLD) {
+        buddy_block_t *block = (buddy_block_t *) ((char *) ptr - BUDDY_HEADER_SIZE);
+        size_t new_block = block_size(size);
+        if (new_block <= (block->block_size_alloc & ~0x1UL)) {
+            shrink_block(block, new_block);
+        } else if (!grow_block(block, new_block)) {
+            new_block = 0;
+        }
+        if (new_block != 0) {
+            STAT_ADD(bytes_live, payload_size(ptr) - old_size);
+            return ptr;
+        }
+    }
+
+    // move the payload to a new block
+    void *new_ptr = umalloc(size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+    ufree(ptr);
+
+    return new_ptr;
+}
+
+/*
+ * utrim - releases the whole pages inside every free block with madvise. The
+ * heap itself never shrinks, since the blocks at its top rarely merge back
+ * into whole chunks. Returns 1 if any memory was released, 0 otherwise.
+ */
+int utrim(size_t pad) {
+    (void) pad;
+    size_t released = 0;
+    size_t page_mask = PAGESIZE - 1;
+    for (int order = 0; order < BUDDY_ORDERS; order++) {
+        for (buddy_block_t *cur = buddy_lists[order]; cur != NULL; cur = cur->next) {
+            size_t start = ((size_t) (cur + 1) + page_mask) & ~page_mask;
+            size_t end = ((size_t) cur + cur->block_size_alloc) & ~page_mask;
+            if (end > start && madvise((void *) start, end - start, MADV_DONTNEED) == 0) {
+                released += end - start;
+            }
+        }
+    }
+
+    return released > 0;
+}
+
+void ustats(ustats_t *stats) {
+#ifdef UMALLOC_STATS
+    *stats = counted;
+    stats->counting = true;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+    for (int order = 0; order < BUDDY_ORDERS; order++) {
+        for (buddy_block_t *cur = buddy_lists[order]; cur != NULL; cur = cur->next) {
+            size_t size = cur->block_size_alloc;
+            int bucket = order + BUDDY_MIN_ORDER - 4;
+            stats->free_blocks++;
+            stats->free_bytes += size;
+            stats->largest_free = (size > stats->largest_free) ? size : stats->largest_free;
+            stats->free_histogram[(bucket < USTATS_BUCKETS) ? bucket : USTATS_BUCKETS - 1]++;
+        }
+    }
+    for (large_block_t *large = mapped_blocks; large != NULL; large = large->next) {
+        stats->mapped_blocks++;
+        stats->mapped_bytes += (large->block.block_size_alloc & ~(size_t) (ALIGNMENT - 1)) + sizeof(large_block_t);
+    }
+#ifdef UMALLOC_HUGE
+    chsbrk_residency(&stats->huge_resident, &stats->huge_bytes);
+#endif
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double) stats->largest_free / stats->free_bytes;
+    }
+}
+
+/*
+ * ustats_print - prints ustats() to out, one line per figure. There is no fit
+ * search to count visits for, a free list of the right size is found with a
+ * find-first-set.
+ */
+void ustats_print(FILE *out) {
+    ustats_t stats;
+    ustats(&stats);
+    fprintf(out, "free blocks:        %zu, %zu bytes, largest %zu\n",
+            stats.free_blocks, stats.free_bytes, stats.largest_free);
+    fprintf(out, "fragmentation:      %.4f\n", stats.fragmentation);
+    fprintf(out, "free block sizes:  ");
+    for (int bucket = 0; bucket < USTATS_BUCKETS; bucket++) {
+        if (stats.free_histogram[bucket] != 0) {
+            fprintf(out, " %zu%s:%zu", (size_t) ALIGNMENT << bucket,
+                    (bucket == USTATS_BUCKETS - 1) ? "+" : "", stats.free_histogram[bucket]);
+        }
+    }
+    fprintf(out, "\n");
+    fprintf(out, "mapped blocks:      %zu, %zu bytes\n", stats.mapped_blocks, stats.mapped_bytes);
+#ifdef UMALLOC_HUGE
+    fprintf(out, "huge page hit rate: %.1f%%, %zu of %zu resident bytes\n",
+            stats.huge_resident ? 100.0 * stats.huge_bytes / stats.huge_resident : 0.0,
+            stats.huge_bytes, stats.huge_resident);
+#endif
+    if (!stats.counting) {
+        fprintf(out, "counters:           off, build with make STATS=1\n");
+        return;
+    }
+    fprintf(out, "allocs/frees:       %zu/%zu, %zu reallocs\n", stats.allocs, stats.frees, stats.reallocs);
+    fprintf(out, "bytes live/held:    %zu/%zu\n", stats.bytes_live, stats.heap_bytes + stats.mapped_bytes);
+    fprintf(out, "splits/coalesces:   %zu/%zu\n", stats.splits, stats.coalesces);
+    fprintf(out, "extends:            %zu\n", stats.extends);
+}
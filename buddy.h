@@ -0,0 +1,46 @@
+#include "umalloc.h"
+
+/*
+ * The buddy engine, buddy.c, serves the umalloc interface from blocks whose
+ * size, header included, is a power of two from BUDDY_MIN_SIZE to
+ * BUDDY_MAX_SIZE, each aligned to its own size from the start of its chunk.
+ * A block splits into two halves, buddies, and merges back with its buddy when
+ * both are free, so the buddy of any block is found by flipping the bit of its
+ * size in its offset from the chunk's start.
+ * There is one free list per size. Requests of MMAP_THRESHOLD bytes or more
+ * are mapped on their own, as in umalloc.c.
+ */
+#define BUDDY_MIN_ORDER 5   /* room for the links of a free block */
+#define BUDDY_MAX_ORDER 16  /* the most csbrk gives at once */
+#define BUDDY_ORDERS (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+#define BUDDY_MIN_SIZE (1UL << BUDDY_MIN_ORDER)
+#define BUDDY_MAX_SIZE (1UL << BUDDY_MAX_ORDER)
+#define BUDDY_HEADER_SIZE ALIGNMENT
+
+/*
+ * buddy_chunk_t - Sits at the start of each run of contiguous memory from
+ * csbrk, followed by its blocks from start to end. Only a buddy inside the
+ * same chunk can merge, since between chunks there may be memory of other
+ * sbrk callers. A chunk grows when the break has not moved since.
+ */
+typedef struct buddy_chunk_struct {
+    char *start;                        /* the first block */
+    char *end;
+    struct buddy_chunk_struct *next;    /* the chunk before it */
+} buddy_chunk_t;
+
+/*
+ * buddy_block_t - The header of a heap block. block_size_alloc holds the
+ * block size, bit0 set when allocated, and chunk the chunk it is in. An
+ * allocated block keeps only these two words, the rest belongs to the
+ * payload. A free block is linked into the list of its size.
+ */
+typedef struct buddy_block_struct {
+    size_t block_size_alloc;
+    buddy_chunk_t *chunk;
+    struct buddy_block_struct *next;
+    struct buddy_block_struct *prev;
+} buddy_block_t;
+
+int buddy_order(size_t size);
+bool is_free_buddy(buddy_block_t *block, size_t size);
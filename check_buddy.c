@@ -0,0 +1,185 @@
+#include "buddy.h"
+#include "csbrk.h"
+static int count_list(int order, buddy_block_t **blocks, unsigned long max_blocks);
+static long walk_chunks(buddy_block_t **blocks, unsigned long max_blocks);
+static int compare_blocks(const void *a, const void *b);
+static int check_mapped();
+
+// Place any variables needed here from buddy.c as an extern.
+extern buddy_block_t *buddy_lists[BUDDY_ORDERS];
+extern unsigned int buddy_bitmap;
+extern unsigned long num_free_blocks;
+extern large_block_t *mapped_blocks;
+extern buddy_chunk_t *buddy_chunks;
+
+/*
+ * check_heap - the check_heap of the buddy engine. Should return 0 if the
+ * heap is still consistent, otherwise return a non-zero return code.
+ */
+int check_heap() {
+    buddy_block_t **listed = malloc((num_free_blocks + 1) * sizeof(buddy_block_t *));
+    buddy_block_t **walked = malloc((num_free_blocks + 1) * sizeof(buddy_block_t *));
+    assert(listed != NULL && walked != NULL);
+    unsigned long free_blocks_count = 0;
+    int result = EXIT_FAILURE;
+
+    for (int order = 0; order < BUDDY_ORDERS; order++) {
+        // Check the bitmap matches the list heads
+        if (((buddy_bitmap >> order) & 0x1) != (buddy_lists[order] != NULL)) {
+            printf("buddy_bitmap bit %d does not match its list\n", order);
+            goto out;
+        }
+        int count = count_list(order, listed + free_blocks_count, num_free_blocks - free_blocks_count);
+        if (count < 0) {
+            goto out;
+        }
+        free_blocks_count += count;
+    }
+    if (buddy_bitmap >> BUDDY_ORDERS != 0) {
+        puts("buddy_bitmap has bits past the largest order");
+        goto out;
+    }
+
+    // Is every free block in the free lists
+    if (free_blocks_count != num_free_blocks) {
+        printf("free_blocks_count %lu != num_free_blocks %lu\n", free_blocks_count, num_free_blocks);
+        goto out;
+    }
+
+    // Are the free blocks in the lists exactly the free blocks in the chunks
+    long walked_count = walk_chunks(walked, num_free_blocks);
+    if (walked_count < 0) {
+        goto out;
+    }
+    if (walked_count != free_blocks_count) {
+        printf("the chunks hold %ld free blocks, the lists %lu\n", walked_count, free_blocks_count);
+        goto out;
+    }
+    qsort(listed, free_blocks_count, sizeof(buddy_block_t *), compare_blocks);
+    qsort(walked, free_blocks_count, sizeof(buddy_block_t *), compare_blocks);
+    for (unsigned long i = 0; i < free_blocks_count; i++) {
+        if (listed[i] != walked[i]) {
+            printf("free block %p is in the lists, %p in the chunks\n", listed[i], walked[i]);
+            goto out;
+        }
+    }
+
+    result = check_mapped();
+out:
+    free(listed);
+    free(walked);
+    return result;
+}
+
+/**
+ * Walk one free list, checking every block in it and recording it in blocks.
+ *
+ * @param order the index of the list.
+ * @param blocks where to record the blocks in the list.
+ * @param max_blocks the number of free blocks that may still be in the list.
+ * @return the number of blocks in the list, or -1 if the list is inconsistent.
+ */
+static int count_list(int order, buddy_block_t **blocks, unsigned long max_blocks) {
+    size_t size = BUDDY_MIN_SIZE << order;
+    int count = 0;
+    buddy_block_t *prev = NULL;
+    for (buddy_block_t *cur = buddy_lists[order]; cur != NULL; cur = cur->next) {
+        // Check for infinite loop
+        if (count >= max_blocks) {
+            printf("list %d holds more than num_free_blocks\n", order);
+            return -1;
+        }
+        // Check the block is free and of the list's size
+        if (cur->block_size_alloc != size) {
+            printf("%p in list %d is not a free %zuB block\n", cur, order, size);
+            return -1;
+        }
+        // Check the back links agree with the forward links
+        if (cur->prev != prev) {
+            printf("%p in list %d links back to %p, expected %p\n", cur, order, cur->prev, prev);
+            return -1;
+        }
+        // Check the block did not escape merging with its buddy
+        if (size < BUDDY_MAX_SIZE && is_free_buddy(cur, size)) {
+            printf("%p and its buddy are both free %zuB blocks\n", cur, size);
+            return -1;
+        }
+        blocks[count++] = cur;
+        prev = cur;
+    }
+    return count;
+}
+
+/**
+ * Walk the blocks of every chunk, checking they are powers of two aligned to
+ * their size from the chunk's start, belong to the chunk and end exactly at
+ * its end, and record the free ones in blocks.
+ *
+ * @param blocks where to record the free blocks.
+ * @param max_blocks the number of free blocks there should be.
+ * @return the number of free blocks, or -1 if a chunk is inconsistent.
+ */
+static long walk_chunks(buddy_block_t **blocks, unsigned long max_blocks) {
+    long count = 0;
+    for (buddy_chunk_t *chunk = buddy_chunks; chunk != NULL; chunk = chunk->next) {
+        if (chunk->start < (char *) (chunk + 1) || (size_t) chunk->start % BUDDY_MIN_SIZE != 0 ||
+            (size_t) chunk->end % BUDDY_MIN_SIZE != 0) {
+            printf("chunk %p has blocks from %p to %p\n", chunk, chunk->start, chunk->end);
+            return -1;
+        }
+        char *cur = chunk->start;
+        while (cur < chunk->end) {
+            buddy_block_t *block = (buddy_block_t *) cur;
+            size_t size = block->block_size_alloc & ~0x1UL;
+            if (size < BUDDY_MIN_SIZE || size > BUDDY_MAX_SIZE || (size & (size - 1)) != 0 ||
+                (size_t) (cur - chunk->start) % size != 0 || block->chunk != chunk) {
+                printf("%p in chunk %p is not a block aligned to its size %zu\n", cur, chunk, size);
+                return -1;
+            }
+            if (!(block->block_size_alloc & 0x1)) {
+                if (count >= max_blocks) {
+                    printf("chunk %p holds more than num_free_blocks\n", chunk);
+                    return -1;
+                }
+                blocks[count++] = block;
+            }
+            cur += size;
+        }
+        if (cur != chunk->end) {
+            printf("the last block of chunk %p runs past its end %p\n", chunk, chunk->end);
+            return -1;
+        }
+    }
+    return count;
+}
+
+/*
+ * orders free blocks by address for qsort.
+ */
+static int compare_blocks(const void *a, const void *b) {
+    buddy_block_t *left = *(buddy_block_t **) a;
+    buddy_block_t *right = *(buddy_block_t **) b;
+    return (left > right) - (left < right);
+}
+
+/*
+ * check_mapped - checks every mapped block starts its mapping, is marked
+ * allocated and mapped, and links back correctly.
+ */
+static int check_mapped() {
+    large_block_t *prev = NULL;
+    for (large_block_t *large = mapped_blocks; large != NULL; large = large->next) {
+        size_t header = large->block.block_size_alloc;
+        if ((size_t) large % PAGESIZE != 0 || !(header & 0x1) || !(header & MAPPED)) {
+            printf("mapped block %p is not a mapped allocated block\n", large);
+            return EXIT_FAILURE;
+        }
+        if (large->prev != prev) {
+            printf("mapped block %p links back to %p, expected %p\n", large, large->prev, prev);
+            return EXIT_FAILURE;
+        }
+        prev = large;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,10 +1,21 @@
 #include "umalloc.h"
+#include "csbrk.h"
+static int count_list(int fl, int sl, memory_block_t **blocks, unsigned long max_blocks);
+static int compare_blocks(const void *a, const void *b);
 static bool check_subsequent_blocks(memory_block_t *prev, memory_block_t *cur);
+static int check_slabs();
+static int check_mapped();
 static void print_list();
 
 // Place any variables needed here from umalloc.c as an extern.
-extern memory_block_t *free_head;
+extern memory_block_t *seg_lists[FL_INDEX_COUNT][SL_INDEX_COUNT];
+extern unsigned int fl_bitmap;
+extern unsigned int sl_bitmap[FL_INDEX_COUNT];
 extern unsigned long num_free_blocks;
+extern fit_index_t fit_index[FL_INDEX_COUNT][SL_INDEX_COUNT];
+extern slab_run_t *slab_partial[SLAB_CLASSES];
+extern slab_run_t *slab_free_pages;
+extern large_block_t *mapped_blocks;
 
 /*
  * check_heap - used to check that the heap is still in a consistent state.
@@ -13,63 +24,228 @@ extern unsigned long num_free_blocks;
  * return code. Asserts are also a useful tool here.
  */
 int check_heap() {
-    memory_block_t *prev = free_head;
-    // Check for NULL free list
-    assert(free_head != NULL);
-    memory_block_t *cur = prev->next;
-    bool all_marked_free = true;
-    unsigned long free_blocks_count = 1;
-
-    assert(get_size(prev) % ALIGNMENT == 0);
-    while (cur != NULL) {
-        // Check for infinite loop
-        assert(cur != cur->next);
-        // Check alignment of free list
-        assert(get_size(cur) % ALIGNMENT == 0);
-        // Check if every block in the free list is marked as unallocated
-        if (is_allocated(prev) || is_allocated(cur)) {
-            all_marked_free = false;
-        } else {
-            // Is every free block in the free list
-            free_blocks_count++;
-        }
-        // Are there any contiguous free blocks that escaped coalescing
-        // Is the free list in increasing address order
-        if (check_subsequent_blocks(prev, cur)) {
+    memory_block_t **blocks = malloc((num_free_blocks + 1) * sizeof(memory_block_t *));
+    assert(blocks != NULL);
+    unsigned long free_blocks_count = 0;
+
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        // Check the first level bitmap matches the second level bitmaps
+        if (((fl_bitmap >> fl) & 0x1) != (sl_bitmap[fl] != 0)) {
+            printf("fl_bitmap bit %d does not match sl_bitmap[%d]\n", fl, fl);
+            free(blocks);
             return EXIT_FAILURE;
         }
-
-        prev = cur;
-        cur = cur->next;
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            // Check the second level bitmap matches the list heads
+            if (((sl_bitmap[fl] >> sl) & 0x1) != (seg_lists[fl][sl] != NULL)) {
+                printf("sl_bitmap[%d] bit %d does not match its list\n", fl, sl);
+                free(blocks);
+                return EXIT_FAILURE;
+            }
+            int count = count_list(fl, sl, blocks + free_blocks_count,
+                                   num_free_blocks - free_blocks_count);
+            if (count < 0) {
+                free(blocks);
+                return EXIT_FAILURE;
+            }
+            free_blocks_count += count;
+        }
     }
 
-    // confirm checks
-    if (!all_marked_free || free_blocks_count != num_free_blocks) {
-        puts("!all_marked_free || free_blocks_count != num_free_blocks");
-        printf("%d, %d\n", !all_marked_free, free_blocks_count != num_free_blocks);
+    // Is every free block in the free lists
+    if (free_blocks_count != num_free_blocks) {
+        puts("free_blocks_count != num_free_blocks");
         printf("exp: %ld == act: %ld\n", free_blocks_count, num_free_blocks);
         print_list();
+        free(blocks);
+        return EXIT_FAILURE;
+    }
+
+    // Are there any contiguous free blocks that escaped coalescing
+    qsort(blocks, free_blocks_count, sizeof(memory_block_t *), compare_blocks);
+    for (unsigned long i = 1; i < free_blocks_count; i++) {
+        if (check_subsequent_blocks(blocks[i - 1], blocks[i])) {
+            free(blocks);
+            return EXIT_FAILURE;
+        }
+    }
+    free(blocks);
 
+    if (check_slabs() != EXIT_SUCCESS) {
         return EXIT_FAILURE;
     }
+    return check_mapped();
+}
+
+/*
+ * check_slabs - checks every partial slab run holds objects of its size class,
+ * has free objects and counts them correctly, and that empty pages are still
+ * marked as slab runs.
+ */
+static int check_slabs() {
+    for (int slab_class = 0; slab_class < SLAB_CLASSES; slab_class++) {
+        slab_run_t *prev = NULL;
+        for (slab_run_t *run = slab_partial[slab_class]; run != NULL; run = run->next) {
+            if (get_slab_run(run) != run || (size_t) run % SLAB_RUN_SIZE != 0) {
+                printf("slab run %p in class %d is not a slab run\n", run, slab_class);
+                return EXIT_FAILURE;
+            }
+            if (run->prev != prev) {
+                printf("slab run %p links back to %p, expected %p\n", run, run->prev, prev);
+                return EXIT_FAILURE;
+            }
+            if (run->obj_size != (slab_class + 1) * ALIGNMENT ||
+                run->num_objs != (SLAB_RUN_SIZE - SLAB_HEADER_SIZE) / run->obj_size) {
+                printf("slab run %p of %u objects of %uB in class %d\n",
+                       run, run->num_objs, run->obj_size, slab_class);
+                return EXIT_FAILURE;
+            }
+            // Count the clear bits, which must all belong to real objects
+            unsigned int free_objs = 0;
+            for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+                free_objs += __builtin_popcountl(~run->bitmap[word]);
+                for (int bit = 0; bit < 64; bit++) {
+                    if (word * 64 + bit >= run->num_objs && !(run->bitmap[word] & (1UL << bit))) {
+                        printf("slab run %p has object %d past its end free\n", run, word * 64 + bit);
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+            if (free_objs != run->num_free || run->num_free == 0) {
+                printf("slab run %p has %u free objects, counted %u\n", run, free_objs, run->num_free);
+                return EXIT_FAILURE;
+            }
+            prev = run;
+        }
+    }
+
+    for (slab_run_t *run = slab_free_pages; run != NULL; run = run->next) {
+        if (get_slab_run(run) != run || run->num_free != run->num_objs) {
+            printf("empty slab page %p is not an empty slab run\n", run);
+            return EXIT_FAILURE;
+        }
+    }
 
     return EXIT_SUCCESS;
 }
 
+/**
+ * Walk one segregated list, checking every block in it and recording it in
+ * blocks.
+ *
+ * @param fl the first level index of the list.
+ * @param sl the second level index of the list.
+ * @param blocks where to record the blocks in the list.
+ * @param max_blocks the number of free blocks that may still be in the list.
+ * @return the number of blocks in the list, or -1 if the list is inconsistent.
+ */
+static int count_list(int fl, int sl, memory_block_t **blocks, unsigned long max_blocks) {
+    int count = 0;
+    unsigned int indexed = 0;
+    memory_block_t *prev = NULL;
+    for (memory_block_t *cur = seg_lists[fl][sl]; cur != NULL; cur = cur->next) {
+        // Check for infinite loop
+        if (count >= max_blocks) {
+            printf("list [%d][%d] holds more than num_free_blocks\n", fl, sl);
+            return -1;
+        }
+        // Check alignment of free list
+        assert(get_size(cur) % ALIGNMENT == 0);
+        assert((size_t) get_payload(cur) % ALIGNMENT == 0);
+        // Check if every block in the free list is marked as unallocated
+        if (is_allocated(cur)) {
+            printf("%p in list [%d][%d] is allocated\n", cur, fl, sl);
+            return -1;
+        }
+        // Check the back links agree with the forward links
+        if (get_prev(cur) != prev) {
+            printf("%p in list [%d][%d] links back to %p, expected %p\n", cur, fl, sl, get_prev(cur), prev);
+            return -1;
+        }
+#ifdef ADDRESS_ORDERED
+        // Is the free list in increasing address order
+        if (prev != NULL && prev >= cur) {
+            printf("list [%d][%d] out of order: %p >= %p\n", fl, sl, prev, cur);
+            return -1;
+        }
+#endif
+        // Check the block is in the list for its size
+        int exp_fl, exp_sl;
+        mapping_insert(get_size(cur), &exp_fl, &exp_sl);
+        if (exp_fl != fl || exp_sl != sl) {
+            printf("%p of size %zu in list [%d][%d], expected [%d][%d]\n",
+                   cur, get_size(cur), fl, sl, exp_fl, exp_sl);
+            return -1;
+        }
+        // Check the footer matches the header
+        size_t footer = *(size_t *) ((char *) get_payload(cur) + get_size(cur) - sizeof(size_t));
+        if (footer != get_size(cur)) {
+            printf("%p has size %zu but footer %zu\n", cur, get_size(cur), footer);
+            return -1;
+        }
+        // Check the neighbours in memory agree this block is free and are
+        // not free themselves
+        memory_block_t *next_block = get_next_block(cur);
+        if (!is_prev_allocated(cur) || !is_allocated(next_block) || is_prev_allocated(next_block)) {
+            printf("%p escaped coalescing or has stale prev allocated bits\n", cur);
+            return -1;
+        }
+        if (is_indexed(cur)) {
+            indexed++;
+        }
+        blocks[count++] = cur;
+        prev = cur;
+    }
+    // Check the fit index holds the indexed blocks of this list, with their sizes
+    fit_index_t *index = &fit_index[fl][sl];
+    if (index->count != indexed || index->unindexed != count - indexed) {
+        printf("list [%d][%d] has %u indexed and %u other blocks, its fit index says %u and %u\n",
+               fl, sl, indexed, count - indexed, index->count, index->unindexed);
+        return -1;
+    }
+    for (int slot = 0; slot < FIT_INDEX_SLOTS; slot++) {
+        if (slot >= index->count) {
+            if (index->sizes[slot] != 0) {
+                printf("unused fit index slot [%d][%d][%d] is not 0\n", fl, sl, slot);
+                return -1;
+            }
+            continue;
+        }
+        memory_block_t *block = index->blocks[slot];
+        int exp_fl, exp_sl;
+        mapping_insert(get_size(block), &exp_fl, &exp_sl);
+        if (is_allocated(block) || !is_indexed(block) || exp_fl != fl || exp_sl != sl ||
+            (size_t) index->sizes[slot] * ALIGNMENT != get_size(block)) {
+            printf("fit index slot [%d][%d][%d] does not match %p\n", fl, sl, slot, block);
+            return -1;
+        }
+    }
+    return count;
+}
+
+/*
+ * orders free blocks by address for qsort.
+ */
+static int compare_blocks(const void *a, const void *b) {
+    memory_block_t *left = *(memory_block_t **) a;
+    memory_block_t *right = *(memory_block_t **) b;
+    return (left > right) - (left < right);
+}
+
 /**
  * Check if subsequent free_blocks did not escape coalescing.
- * Check if free blocks are in memory order.
- * 
- * @param prev is the previous memory_block_t in the free list.
- * @param cur is the current memory_block_t in the free list.
- * @return true if blocks not in increasing order of memory or escaped coalescing.
+ * Check if free blocks overlap.
+ *
+ * @param prev is the previous free block in memory order.
+ * @param cur is the next free block in memory order.
+ * @return true if blocks overlap or escaped coalescing.
  */
 static bool check_subsequent_blocks(memory_block_t *prev, memory_block_t *cur) {
     size_t prev_size = get_size(prev) + ALIGNMENT;
-    if ((memory_block_t *)((char *)prev + prev_size) == cur || prev >= cur) {
+    if ((memory_block_t *)((char *)prev + prev_size) >= cur) {
         puts("check_subsequent_blocks(prev, cur)");
         printf("%d, %d ", (memory_block_t *)((char *)prev + prev_size) == cur, prev >= cur);
-        printf("%p >= %p\n", prev, cur);
+        printf("%p >= %p\n", (char *)prev + prev_size, cur);
         print_list();
 
         return true;
@@ -78,15 +254,47 @@ static bool check_subsequent_blocks(memory_block_t *prev, memory_block_t *cur) {
 }
 
 /*
- * print the address and size of each free block in the free list.
+ * print the address and size of each free block in each segregated list.
  * for debugging purposes.
  */
 static void print_list() {
-    memory_block_t *cur = free_head;
     printf("DEBUG: ");
-    while (cur != NULL) {
-        printf("%p: %zu, ", cur, get_size(cur));
-        assert(cur != cur->next);
-        cur = cur->next;
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            if (seg_lists[fl][sl] == NULL) {
+                continue;
+            }
+            printf("[%d][%d] ", fl, sl);
+            unsigned long count = 0;
+            for (memory_block_t *cur = seg_lists[fl][sl]; cur != NULL && count <= num_free_blocks; cur = cur->next) {
+                printf("%p: %zu, ", cur, get_size(cur));
+                count++;
+            }
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * check_mapped - checks every mapped block sits where map_block puts it in its
+ * mapping, is marked allocated and mapped, and links back correctly.
+ */
+static int check_mapped() {
+    large_block_t *prev = NULL;
+    for (large_block_t *large = mapped_blocks; large != NULL; large = large->next) {
+        // the header starts its mapping, or ends the first page for aligned payloads
+        size_t offset = (size_t) large % PAGESIZE;
+        if ((offset != 0 && offset != PAGESIZE - sizeof(large_block_t)) || !is_allocated(&large->block) ||
+            !is_mapped(&large->block)) {
+            printf("mapped block %p is not a mapped allocated block\n", large);
+            return EXIT_FAILURE;
+        }
+        if (large->prev != prev) {
+            printf("mapped block %p links back to %p, expected %p\n", large, large->prev, prev);
+            return EXIT_FAILURE;
+        }
+        prev = large;
     }
+
+    return EXIT_SUCCESS;
 }
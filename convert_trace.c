@@ -0,0 +1,22 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * convert_trace.c - Converts a text trace (.rep) into the binary trace format
+ * that runner and performance map in place.
+ **************************************************************************/
+
+#include "support.h"
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: convert_trace in.rep out.bin\n");
+        exit(1);
+    }
+
+    trace_t *trace = read_trace(argv[1], 0);
+    write_trace_binary(trace, argv[2]);
+    printf("Wrote %d ops over %d ids to %s\n", trace->num_ops, trace->num_ids, argv[2]);
+    free_trace(trace);
+
+    return 0;
+}
@@ -9,20 +9,104 @@
  * May not be used, modified, or copied without permission.
  **************************************************************************/
 
+#define _GNU_SOURCE /* for mremap */
 #include "csbrk.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
 
-sbrk_block *sbrk_blocks = NULL;
-size_t sbrk_bytes;
+static char *huge_start = NULL;  /* the region chsbrk moves its break through */
+static char *huge_break = NULL;
+size_t sbrk_bytes;  /* the most bytes ever held from csbrk and cmmap at once */
+size_t held_bytes;  /* the bytes held from csbrk and cmmap right now */
+
+/*
+ * track_bytes - adds delta to the bytes currently held, and raises sbrk_bytes
+ * to match a new peak. Counted in every build, since it costs nothing next to
+ * the system call, so any harness can read the footprint.
+ */
+static void track_bytes(intptr_t delta)
+{
+    held_bytes += delta;
+    if (held_bytes > sbrk_bytes) {
+        sbrk_bytes = held_bytes;
+    }
+}
+#ifdef TRACK_CSBRK
+/*
+ * Every tracked region, the sbrk chunks and the live mappings, sorted by
+ * start. Regions never overlap, so the one that may hold an address is the
+ * last to start at or before it, found by binary search.
+ */
+static sbrk_block *regions = NULL;
+static size_t num_regions = 0;
+static size_t max_regions = 0;
+
+/*
+ * region_before - returns the index of the last region starting at or before
+ * addr, or -1 if there is none.
+ */
+static long region_before(uint64_t addr)
+{
+    size_t low = 0, high = num_regions;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (regions[mid].sbrk_start <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (long)low - 1;
+}
+
+/*
+ * add_region - starts tracking the region from start to end.
+ */
+static void add_region(uint64_t start, uint64_t end)
+{
+    if (num_regions == max_regions) {
+        max_regions = (max_regions == 0) ? 64 : max_regions * 2;
+        regions = realloc(regions, max_regions * sizeof(sbrk_block));
+        assert(regions != NULL);
+    }
+    size_t index = region_before(start) + 1;
+    memmove(&regions[index + 1], &regions[index], (num_regions - index) * sizeof(sbrk_block));
+    regions[index].sbrk_start = start;
+    regions[index].sbrk_end = end;
+    num_regions++;
+}
+
+/*
+ * find_region - returns the tracked region starting at start.
+ */
+static sbrk_block *find_region(void *start)
+{
+    long index = region_before((uint64_t)start);
+    assert(index >= 0 && regions[index].sbrk_start == (uint64_t)start);
+    return &regions[index];
+}
+
+/*
+ * remove_region - stops tracking a region from find_region.
+ */
+static void remove_region(sbrk_block *region)
+{
+    size_t index = region - regions;
+    memmove(region, region + 1, (num_regions - index - 1) * sizeof(sbrk_block));
+    num_regions--;
+}
+#endif
 
 /*
  * csbrk - A wrapper for sbrk. Places a maximum on the maximum amount of memory
  * that can be requested. If tracking is enabled, keeps track of the sbrk regions
- * allocated for correctness and utilization.
+ * allocated for correctness and utilization. A negative increment shrinks the
+ * region that ends at the break.
  */
 void *csbrk(intptr_t increment)
 {
@@ -34,52 +118,226 @@ void *csbrk(intptr_t increment)
     }
 
     void *ret = sbrk(increment);
+    if (ret == (void *)-1) {
+        return ret;
+    }
+    track_bytes(increment);
 #ifdef TRACK_CSBRK
-    sbrk_bytes += increment;
-    uint64_t sbrk_start_temp = (uint64_t)ret;
-    uint64_t sbrk_end_temp = sbrk_start_temp + (uint64_t)increment;
-    bool coalesced = false;
-    sbrk_block *temp = sbrk_blocks;
-    while (temp != NULL)
-    {
-        if (temp->sbrk_end == sbrk_start_temp){
-            temp->sbrk_end = sbrk_end_temp;
-            coalesced = true;
-            break;
+    // the chunk ending at the old break grows or shrinks with it
+    long index = region_before((uint64_t)ret - 1);
+    if (index >= 0 && regions[index].sbrk_end == (uint64_t)ret) {
+        assert(increment >= 0 || regions[index].sbrk_end - regions[index].sbrk_start >= (uint64_t)-increment);
+        regions[index].sbrk_end += increment;
+    } else if (increment > 0) {
+        add_region((uint64_t)ret, (uint64_t)ret + increment);
+    } else {
+        assert(increment == 0);
+    }
+#endif
+
+    return ret;
+}
+
+/*
+ * reserve_huge_region - maps the region for chsbrk, aligned to HUGE_PAGE_SIZE
+ * by mapping a huge page more and unmapping the ends. The pages are only
+ * committed when first touched. Returns false if the mapping fails.
+ */
+static bool reserve_huge_region(void)
+{
+    size_t length = HUGE_REGION_SIZE + HUGE_PAGE_SIZE;
+    char *start = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        return false;
+    }
+    char *aligned = (char *)(((uint64_t)start + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    munmap(aligned + HUGE_REGION_SIZE, start + length - (aligned + HUGE_REGION_SIZE));
+    // only a request, the kernel may still hand out small pages
+    madvise(aligned, HUGE_REGION_SIZE, MADV_HUGEPAGE);
+    huge_start = aligned;
+    huge_break = aligned;
+#ifdef TRACK_CSBRK
+    add_region((uint64_t)aligned, (uint64_t)aligned);
+#endif
+
+    return true;
+}
+
+/*
+ * chsbrk - Moves the break of the huge page region the way csbrk moves the
+ * real one, with the same limit on a single request, and returns the old
+ * break. Nothing else allocates in the region, so the heap in it is always
+ * contiguous. Shrinking gives the whole huge pages past the new break back
+ * to the kernel and clears the rest. Returns NULL if the request is too large
+ * or the region is full.
+ */
+void *chsbrk(intptr_t increment)
+{
+    if (increment > 16 * PAGESIZE) {
+        fprintf(stderr, "Memory request execeeds limit\n");
+        return NULL;
+    }
+    if (huge_start == NULL && !reserve_huge_region()) {
+        return NULL;
+    }
+    if (increment > huge_start + HUGE_REGION_SIZE - huge_break || increment < huge_start - huge_break) {
+        return NULL;
+    }
+
+    char *ret = huge_break;
+    huge_break += increment;
+    if (increment < 0) {
+        // releasing part of a huge page would split it, so only whole huge
+        // pages go back and the rest is cleared, reading as zeros either way
+        char *release =
+            (char *)(((uint64_t)huge_break + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1));
+        if (release < ret) {
+            madvise(release, ret - release, MADV_DONTNEED);
+        }
+        memset(huge_break, 0, ((release < ret) ? release : ret) - huge_break);
+    }
+    track_bytes(increment);
+#ifdef TRACK_CSBRK
+    find_region(huge_start)->sbrk_end = (uint64_t)huge_break;
+#endif
+
+    return ret;
+}
+
+/*
+ * chsbrk_residency - Reads from /proc/self/smaps how many bytes of the huge
+ * page region are resident, and how many of those sit in huge pages. Returns
+ * -1 if the region was never reserved or smaps cannot be read.
+ */
+int chsbrk_residency(size_t *resident, size_t *huge)
+{
+    *resident = 0;
+    *huge = 0;
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (huge_start == NULL || smaps == NULL) {
+        if (smaps != NULL) {
+            fclose(smaps);
+        }
+        return -1;
+    }
+    char line[256];
+    bool in_region = false;
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        uint64_t start, end;
+        size_t kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            // the region may have been split, so take every part of it
+            in_region = start >= (uint64_t)huge_start && end <= (uint64_t)huge_start + HUGE_REGION_SIZE;
+        } else if (in_region && sscanf(line, "Rss: %zu kB", &kb) == 1) {
+            *resident += kb * 1024;
+        } else if (in_region && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            *huge += kb * 1024;
         }
-        temp = temp->next;
     }
+    fclose(smaps);
+
+    return 0;
+}
+
+/*
+ * cmmap - Maps length bytes of fresh memory outside the sbrk heap, for
+ * allocations too large for csbrk. Returns NULL if the mapping fails. The
+ * mapping counts towards sbrk_bytes until it is unmapped.
+ */
+void *cmmap(size_t length)
+{
+    void *ret = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret == MAP_FAILED) {
+        return NULL;
+    }
+    track_bytes(length);
+#ifdef TRACK_CSBRK
+    add_region((uint64_t)ret, (uint64_t)ret + length);
+#endif
 
-    if (!coalesced) {
-        sbrk_block *temp = malloc(sizeof(sbrk_block));
-        temp->sbrk_start = sbrk_start_temp;
-        temp->sbrk_end = sbrk_end_temp;
+    return ret;
+}
 
-        temp->next = sbrk_blocks;
-        sbrk_blocks = temp;
+/*
+ * cmremap - Resizes a mapping from cmmap, moving it if it cannot grow in
+ * place. Returns the new start of the mapping, or NULL if it fails, in which
+ * case the old mapping is untouched.
+ */
+void *cmremap(void *addr, size_t old_length, size_t new_length)
+{
+    void *ret = mremap(addr, old_length, new_length, MREMAP_MAYMOVE);
+    if (ret == MAP_FAILED) {
+        return NULL;
     }
+    track_bytes(new_length - old_length);
+#ifdef TRACK_CSBRK
+    remove_region(find_region(addr));
+    add_region((uint64_t)ret, (uint64_t)ret + new_length);
 #endif
 
     return ret;
 }
 
+/*
+ * cmunmap - Unmaps a mapping from cmmap and stops tracking it.
+ */
+int cmunmap(void *addr, size_t length)
+{
+    track_bytes(-(intptr_t)length);
+#ifdef TRACK_CSBRK
+    remove_region(find_region(addr));
+#endif
+
+    return munmap(addr, length);
+}
+
+/*
+ * resident_bytes - Returns how many bytes of the tracked regions are in
+ * memory, in whole pages as mincore sees them, so pages given back with
+ * madvise, or never touched, do not count. Only tracks regions when built
+ * with TRACK_CSBRK, and returns 0 otherwise.
+ */
+size_t resident_bytes(void)
+{
+    size_t resident = 0;
+#ifdef TRACK_CSBRK
+    unsigned char pages[1024];
+    for (size_t i = 0; i < num_regions; i++) {
+        uint64_t start = regions[i].sbrk_start & ~(uint64_t)(PAGESIZE - 1);
+        while (start < regions[i].sbrk_end) {
+            size_t count = (regions[i].sbrk_end - start + PAGESIZE - 1) / PAGESIZE;
+            count = (count < sizeof(pages)) ? count : sizeof(pages);
+            if (mincore((void *)start, count * PAGESIZE, pages) == 0) {
+                for (size_t page = 0; page < count; page++) {
+                    resident += (pages[page] & 1) ? PAGESIZE : 0;
+                }
+            }
+            start += count * PAGESIZE;
+        }
+    }
+#endif
+    return resident;
+}
+
 /*
  * check_malloc_output - Checks that a payload returned by umalloc falls within
- * one of the sbrk regions.
+ * one of the sbrk regions or a live mapping. Only tracks regions when built
+ * with TRACK_CSBRK, and fails otherwise.
  */
 int check_malloc_output(void *payload_start, size_t payload_length)
 {
+#ifdef TRACK_CSBRK
     uint64_t start_uint = (uint64_t)payload_start;
     uint64_t end_uint = start_uint + (uint64_t)payload_length;
-    sbrk_block *temp = sbrk_blocks;
-    while (temp != NULL)
-    {
-        if (start_uint >= temp->sbrk_start && end_uint <= temp->sbrk_end)
-        {
-            return 0;
-        }
-        temp = temp->next;
+    long index = region_before(start_uint);
+    if (index >= 0 && end_uint <= regions[index].sbrk_end) {
+        return 0;
     }
+#endif
 
     return -1;
-}
\ No newline at end of file
+}
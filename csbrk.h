@@ -18,8 +18,24 @@ typedef struct sbrk_block_struct
 {
     uint64_t sbrk_start;
     uint64_t sbrk_end;
-    struct sbrk_block_struct *next;
 } sbrk_block;
 
+/*
+ * chsbrk works like csbrk on a break of its own, inside a HUGE_REGION_SIZE
+ * region of address space reserved on the first call. The region is aligned
+ * to HUGE_PAGE_SIZE and marked for transparent huge pages, so the kernel can
+ * back each whole 2 MiB of it with a single TLB entry.
+ */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#ifndef HUGE_REGION_SIZE
+#define HUGE_REGION_SIZE (1024UL * 1024 * 1024)
+#endif
+
 void *csbrk(intptr_t increment);
+void *chsbrk(intptr_t increment);
+int chsbrk_residency(size_t *resident, size_t *huge);
+void *cmmap(size_t length);
+void *cmremap(void *addr, size_t old_length, size_t new_length);
+int cmunmap(void *addr, size_t length);
+size_t resident_bytes(void);
 int check_malloc_output(void *payload_start, size_t payload_length);
\ No newline at end of file
@@ -0,0 +1,314 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * footprint.c - Replays traces offline, knowing every lifetime in advance, to
+ * find how small a heap any non-moving allocator paying umalloc's header and
+ * alignment could have managed, and how far umalloc is from it.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "csbrk.h"
+#include "support.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+extern size_t sbrk_bytes;
+
+/*
+ * One payload from its alloc or realloc to its free or realloc, or the end of
+ * the trace. A realloc ends one interval and starts the next at the same op.
+ * The heap block it needs is size bytes, header and alignment included.
+ */
+typedef struct {
+    size_t start;           /* op that allocated it */
+    size_t end;             /* op that freed it, num_ops if never */
+    size_t size;
+    size_t offset;          /* where the packing placed it */
+    bool placed;
+} interval_t;
+
+/* The results for one trace */
+typedef struct {
+    size_t max_live;        /* most payload bytes live at once */
+    size_t bound;           /* most block bytes live at once */
+    size_t packed;          /* the heap of the best offline packing found */
+    size_t umalloc;         /* umalloc's peak, as runner measures it */
+} footprint_t;
+
+static size_t header_size = sizeof(memory_block_t);
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: footprint [-h] [-H header] trace...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-H header  Bytes of header per block (default %zu, as umalloc).\n", sizeof(memory_block_t));
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+/*
+ * block_size - The heap block a request of size bytes takes, the way umalloc
+ * sizes it: aligned, at least ALIGNMENT, plus the header, except that slab
+ * sized requests have no header of their own. The slab run headers are left
+ * out, which only lowers the bound.
+ */
+static size_t block_size(size_t size) {
+    size = (size < ALIGNMENT) ? ALIGNMENT : ALIGN(size);
+    return (size <= SLAB_MAX_SIZE) ? size : header_size + size;
+}
+
+/*
+ * build_intervals - Turns the trace into the lifetime of every payload, in
+ * the order they start. Frees of ids that are not allocated are ignored. If
+ * in_place is set, a realloc instead grows the interval of the payload it
+ * resizes to the larger size, as if every realloc of it stayed where it was.
+ * Returns the number of intervals.
+ */
+static size_t build_intervals(trace_t *trace, interval_t *intervals, bool in_place) {
+    size_t count = 0;
+    long *open = malloc(trace->num_ids * sizeof(long));
+    assert(open != NULL);
+    for (int id = 0; id < trace->num_ids; id++) {
+        open[id] = -1;
+    }
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        traceop_t op = trace->ops[curr_op];
+        if (in_place && op.type == REALLOC && open[op.index] != -1) {
+            interval_t *resized = &intervals[open[op.index]];
+            resized->size = (op.size > resized->size) ? op.size : resized->size;
+            continue;
+        }
+        // allocating an id that is still allocated leaks its payload
+        if (open[op.index] != -1 && op.type != ALLOC) {
+            intervals[open[op.index]].end = curr_op;
+            open[op.index] = -1;
+        }
+        if (op.type != FREE) {
+            intervals[count] = (interval_t) {curr_op, trace->num_ops, op.size, 0, false};
+            open[op.index] = count++;
+        }
+    }
+    free(open);
+    return count;
+}
+
+/*
+ * max_load - The most bytes live at once, counting each interval as its
+ * payload if payload is set and as its block otherwise. An interval ending at
+ * an op is gone by the time the next one starts there, so a realloc never
+ * counts both its old and new payload: no allocator can need less.
+ */
+static size_t max_load(interval_t *intervals, size_t count, size_t num_ops, bool payload) {
+    long *delta = calloc(num_ops + 1, sizeof(long));
+    assert(delta != NULL);
+    for (size_t i = 0; i < count; i++) {
+        size_t size = payload ? intervals[i].size : block_size(intervals[i].size);
+        delta[intervals[i].start] += size;
+        delta[intervals[i].end] -= size;
+    }
+    size_t live = 0, max = 0;
+    for (size_t curr_op = 0; curr_op <= num_ops; curr_op++) {
+        live += delta[curr_op];
+        max = (live > max) ? live : max;
+    }
+    free(delta);
+    return max;
+}
+
+static int by_size(const void *a, const void *b) {
+    const interval_t *left = *(interval_t **) a, *right = *(interval_t **) b;
+    if (left->size != right->size) {
+        return (left->size < right->size) - (left->size > right->size);
+    }
+    return (left->start > right->start) - (left->start < right->start);
+}
+
+static int by_start(const void *a, const void *b) {
+    const interval_t *left = *(interval_t **) a, *right = *(interval_t **) b;
+    return (left->start > right->start) - (left->start < right->start);
+}
+
+static int by_offset(const void *a, const void *b) {
+    const interval_t *left = *(interval_t **) a, *right = *(interval_t **) b;
+    return (left->offset > right->offset) - (left->offset < right->offset);
+}
+
+/*
+ * pack - Places the intervals in the given order, each at the lowest offset
+ * clear of every placed interval it shares an op with, and returns the heap
+ * that takes. Here both ends of an interval count, so a realloc holds its old
+ * and new payload at once while it copies. The result is a heap a non-moving
+ * allocator knowing the future could have used, so the smallest one is never
+ * below the optimum.
+ */
+static size_t pack(interval_t **order, size_t count) {
+    interval_t **conflicts = malloc(count * sizeof(interval_t *));
+    assert(conflicts != NULL);
+    size_t heap = 0;
+    for (size_t i = 0; i < count; i++) {
+        order[i]->placed = false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        interval_t *next = order[i];
+        size_t size = block_size(next->size), num_conflicts = 0;
+        for (size_t j = 0; j < i; j++) {
+            if (order[j]->start <= next->end && next->start <= order[j]->end) {
+                conflicts[num_conflicts++] = order[j];
+            }
+        }
+        qsort(conflicts, num_conflicts, sizeof(interval_t *), by_offset);
+        size_t offset = 0;
+        for (size_t j = 0; j < num_conflicts && conflicts[j]->offset < offset + size; j++) {
+            size_t end = conflicts[j]->offset + block_size(conflicts[j]->size);
+            offset = (end > offset) ? end : offset;
+        }
+        next->offset = offset;
+        next->placed = true;
+        heap = (offset + size > heap) ? offset + size : heap;
+    }
+    free(conflicts);
+    return heap;
+}
+
+/*
+ * replay_umalloc - The peak umalloc holds on the trace, replayed in a child
+ * the way runner replays it, other sbrk callers included, so it matches
+ * runner's utilization. Returns 0 if the replay fails.
+ */
+static size_t replay_umalloc(trace_t *trace) {
+    int fds[2];
+    size_t peak = 0;
+    if (pipe(fds) == -1) {
+        appl_error("pipe failed.");
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1) {
+        appl_error("fork failed.");
+    } else if (pid == 0) {
+        close(fds[0]);
+        if (uinit() == -1) {
+            _exit(1);
+        }
+        memset(trace->blocks, 0, trace->num_ids * sizeof(allocated_block_t));
+        for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+            if (curr_op % 5 == 0) {
+                void *ret = sbrk(4096);
+                mprotect(ret, 4096, PROT_NONE);
+            }
+            traceop_t op = trace->ops[curr_op];
+            allocated_block_t *block = &trace->blocks[op.index];
+            if (op.type == ALLOC) {
+                block->payload = umalloc(op.size);
+            } else if (op.type == REALLOC) {
+                block->payload = urealloc(block->is_allocated ? block->payload : NULL, op.size);
+            } else if (block->is_allocated) {
+                ufree(block->payload);
+            }
+            block->is_allocated = op.type != FREE;
+            if (block->is_allocated && block->payload == NULL) {
+                _exit(1);
+            }
+        }
+        if (write(fds[1], &sbrk_bytes, sizeof(sbrk_bytes)) != sizeof(sbrk_bytes)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    if (read(fds[0], &peak, sizeof(peak)) != sizeof(peak)) {
+        peak = 0;
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return peak;
+}
+
+/*
+ * measure - Finds every footprint of one trace. The packing is tried on the
+ * intervals with reallocs moving and staying in place, and each of them
+ * largest first, which keeps big blocks from being boxed in by small ones,
+ * and in the order of the trace, which is first fit knowing which blocks are
+ * live; the smallest heap is kept.
+ */
+static footprint_t measure(char *filename) {
+    footprint_t result = {0};
+    trace_t *trace = read_trace(filename, 0);
+    interval_t *intervals = malloc((trace->num_ops + 1) * sizeof(interval_t));
+    interval_t **order = malloc((trace->num_ops + 1) * sizeof(interval_t *));
+    assert(intervals != NULL && order != NULL);
+
+    size_t count = build_intervals(trace, intervals, false);
+    result.max_live = max_load(intervals, count, trace->num_ops, true);
+    result.bound = max_load(intervals, count, trace->num_ops, false);
+    result.packed = SIZE_MAX;
+    for (int in_place = 0; in_place < 2; in_place++) {
+        count = build_intervals(trace, intervals, in_place);
+        for (size_t i = 0; i < count; i++) {
+            order[i] = &intervals[i];
+        }
+        qsort(order, count, sizeof(interval_t *), by_size);
+        size_t packed = pack(order, count);
+        result.packed = (packed < result.packed) ? packed : result.packed;
+        qsort(order, count, sizeof(interval_t *), by_start);
+        packed = pack(order, count);
+        result.packed = (packed < result.packed) ? packed : result.packed;
+    }
+    result.umalloc = replay_umalloc(trace);
+
+    free(order);
+    free(intervals);
+    free_trace(trace);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    char c;
+
+    while ((c = getopt(argc, argv, "hH:")) != EOF) {
+        switch (c) {
+        case 'H':
+            header_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        appl_error("No File parameter provided.");
+    }
+
+    double total_gap = 0.0, total_packed_gap = 0.0;
+    int measured = 0;
+    printf("%-28s %10s %10s %10s %10s %8s %8s %8s %9s %9s\n", "trace", "max live", "bound", "packed", "umalloc",
+           "util", "bound", "packed", "gap", "vs packed");
+    for (int i = optind; i < argc; i++) {
+        footprint_t result = measure(argv[i]);
+        if (result.umalloc == 0 || result.bound == 0) {
+            printf("%-28s %10zu %10zu %10zu %10s\n", argv[i], result.max_live, result.bound, result.packed, "failed");
+            continue;
+        }
+        // how much more umalloc holds than no allocator could avoid, and
+        // than one knowing the future did need
+        double gap = 100.0 * ((double) result.umalloc / result.bound - 1.0);
+        double packed_gap = 100.0 * ((double) result.umalloc / result.packed - 1.0);
+        printf("%-28s %10zu %10zu %10zu %10zu %7.2f%% %7.2f%% %7.2f%% %8.1f%% %8.1f%%\n", argv[i],
+               result.max_live, result.bound, result.packed, result.umalloc, 100.0 * result.max_live / result.umalloc,
+               100.0 * result.max_live / result.bound, 100.0 * result.max_live / result.packed, gap, packed_gap);
+        total_gap += gap;
+        total_packed_gap += packed_gap;
+        measured++;
+    }
+    if (measured > 1) {
+        printf("%-28s %10s %10s %10s %10s %8s %8s %8s %8.1f%% %8.1f%%\n", "average", "", "", "", "", "", "", "",
+               total_gap / measured, total_packed_gap / measured);
+    }
+    return 0;
+}
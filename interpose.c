@@ -0,0 +1,263 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * interpose.c - Exports the C allocation functions on top of the thread safe
+ * umalloc build, so any dynamically linked program can run on umalloc:
+ *
+ *     LD_PRELOAD=./libumalloc.so program args...
+ *
+ * The heap is set up on the first call. Calls made while umalloc itself is
+ * running on the same thread, such as the allocations made by
+ * pthread_atfork during setup, are served from a small static arena instead
+ * of recursing.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "csbrk.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define EXPORT __attribute__((visibility("default")))
+#define BOOTSTRAP_SIZE (64 * 1024)
+/* marks a payload memalign aligned itself, see aligned_header_t */
+#define ALIGNED_MAGIC 0xa11a11eda11a11edUL
+
+/* Sits right before a payload aligned past PAGESIZE, inside a larger block */
+typedef struct {
+    size_t magic;       /* ALIGNED_MAGIC ^ the aligned payload */
+    void *block;        /* the payload umalloc returned */
+} aligned_header_t;
+
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(ALIGNMENT)));
+static size_t bootstrap_used;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+static bool heap_ready = false;
+static __thread int depth __attribute__((tls_model("initial-exec")));
+
+/*
+ * init_heap - sets up the heap on the first allocation.
+ */
+static void init_heap(void) {
+    if (uinit() != 0) {
+        abort();
+    }
+    heap_ready = true;
+}
+
+/*
+ * enter - marks this thread as inside umalloc, setting up the heap if needed.
+ * Returns false if it already was, and the caller must use the bootstrap
+ * arena.
+ */
+static bool enter(void) {
+    if (depth > 0) {
+        return false;
+    }
+    depth++;
+    if (!heap_ready) {
+        pthread_once(&heap_once, init_heap);
+    }
+    return true;
+}
+
+static void leave(void) {
+    depth--;
+}
+
+/*
+ * bootstrap_alloc - bump allocates from the static arena. Each payload is
+ * preceded by its size so realloc can copy it out. Nothing here is ever
+ * freed.
+ */
+static void *bootstrap_alloc(size_t size) {
+    if (size > BOOTSTRAP_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t total = ALIGN(size) + ALIGNMENT;
+    size_t offset = __atomic_fetch_add(&bootstrap_used, total, __ATOMIC_RELAXED);
+    if (offset + total > BOOTSTRAP_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t *header = (size_t *) (bootstrap + offset);
+    header[0] = ALIGN(size);
+    return header + 2;
+}
+
+static bool is_bootstrap(void *ptr) {
+    return (char *) ptr >= bootstrap && (char *) ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/*
+ * get_aligned_header - returns the header of a payload memalign aligned
+ * itself, or NULL for any other payload. The word before every umalloc payload is readable,
+ * and the magic is keyed on the payload so a stale header never matches.
+ */
+static aligned_header_t *get_aligned_header(void *ptr) {
+    aligned_header_t *header = (aligned_header_t *) ptr - 1;
+    if (header->magic != (ALIGNED_MAGIC ^ (size_t) ptr)) {
+        return NULL;
+    }
+    return header;
+}
+
+/*
+ * usable_size - the bytes usable at a payload from any of the paths above.
+ */
+static size_t usable_size(void *ptr) {
+    if (is_bootstrap(ptr)) {
+        return ((size_t *) ptr)[-2];
+    }
+    aligned_header_t *header = get_aligned_header(ptr);
+    if (header != NULL) {
+        return umalloc_usable_size(header->block) - ((char *) ptr - (char *) header->block);
+    }
+    return umalloc_usable_size(ptr);
+}
+
+EXPORT void *malloc(size_t size) {
+    if (!enter()) {
+        return bootstrap_alloc(size);
+    }
+    void *ptr = umalloc(size);
+    leave();
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void free(void *ptr) {
+    if (ptr == NULL || is_bootstrap(ptr)) {
+        return;
+    }
+    aligned_header_t *header = get_aligned_header(ptr);
+    if (header != NULL) {
+        header->magic = 0;
+        ptr = header->block;
+    }
+    depth++;
+    ufree(ptr);
+    depth--;
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!enter()) {
+        // the bootstrap arena is never reused, so it is still zeroed
+        return bootstrap_alloc(total);
+    }
+    void *ptr = ucalloc(nmemb, size);
+    leave();
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr != NULL && (is_bootstrap(ptr) || get_aligned_header(ptr) != NULL)) {
+        // these cannot grow in place, so move them to a plain block
+        void *new_ptr = malloc(size);
+        if (new_ptr != NULL) {
+            size_t old_size = usable_size(ptr);
+            memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+            free(ptr);
+        }
+        return new_ptr;
+    }
+    if (!enter()) {
+        return NULL;
+    }
+    void *new_ptr = urealloc(ptr, size);
+    leave();
+    if (new_ptr == NULL && size != 0) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, total);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return malloc(size);
+    }
+    if (alignment <= PAGESIZE && enter()) {
+        void *ptr = ualigned_alloc(alignment, size);
+        leave();
+        if (ptr == NULL) {
+            errno = ENOMEM;
+        }
+        return ptr;
+    }
+    // ualigned_alloc stops at PAGESIZE, so past it slide the payload up to the
+    // alignment, leaving space for a header
+    size_t total;
+    if (__builtin_add_overflow(size, alignment + sizeof(aligned_header_t), &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *block = malloc(total);
+    if (block == NULL) {
+        return NULL;
+    }
+    size_t aligned = ((size_t) block + sizeof(aligned_header_t) + alignment - 1) & ~(alignment - 1);
+    aligned_header_t *header = (aligned_header_t *) aligned - 1;
+    header->magic = ALIGNED_MAGIC ^ aligned;
+    header->block = block;
+    return (void *) aligned;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    // a power of two multiple of sizeof(void *), which 0 is not
+    if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return memalign(PAGESIZE, size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return usable_size(ptr);
+}
+
+EXPORT int malloc_trim(size_t pad) {
+    if (!enter()) {
+        return 0;
+    }
+    int released = utrim(pad);
+    leave();
+    return released;
+}
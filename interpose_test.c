@@ -0,0 +1,110 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * interpose_test.c - Checks that the functions libumalloc.so exports fail
+ * the way the C library's do: bad alignments with EINVAL, and requests the
+ * heap cannot grow for with NULL or ENOMEM rather than a crash. Run it on
+ * umalloc with make test, or by hand:
+ *
+ *     LD_PRELOAD=./libumalloc.so ./interpose_test
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+#define ADDRESS_SPACE_LEFT (64UL * 1024 * 1024)   /* what the process may still map */
+
+static int failures = 0;
+
+/*
+ * expect - Counts a failure and prints what was checked when ok is false.
+ */
+static void expect(int ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+/*
+ * check_alignments - posix_memalign takes only powers of two that are
+ * multiples of sizeof(void *), and reports any other with EINVAL.
+ */
+static void check_alignments(void) {
+    void *ptr = NULL;
+    expect(posix_memalign(&ptr, 0, 64) == EINVAL, "posix_memalign alignment 0 gives EINVAL");
+    expect(posix_memalign(&ptr, 4, 64) == EINVAL, "posix_memalign alignment 4 gives EINVAL");
+    expect(posix_memalign(&ptr, 24, 64) == EINVAL, "posix_memalign alignment 24 gives EINVAL");
+    expect(posix_memalign(&ptr, 64, 64) == 0 && (size_t) ptr % 64 == 0, "posix_memalign alignment 64");
+    free(ptr);
+}
+
+/*
+ * check_oversize - Sizes no heap can hold fail at once.
+ */
+static void check_oversize(void) {
+    void *ptr = NULL;
+    volatile size_t huge = SIZE_MAX;
+    errno = 0;
+    expect(malloc(huge) == NULL && errno == ENOMEM, "malloc(SIZE_MAX) gives ENOMEM");
+    expect(posix_memalign(&ptr, 64, huge - 100) == ENOMEM, "posix_memalign(SIZE_MAX - 100) gives ENOMEM");
+    void *kept = malloc(100);
+    errno = 0;
+    void *moved = realloc(kept, huge);
+    expect(moved == NULL && errno == ENOMEM, "realloc(SIZE_MAX) gives ENOMEM");
+    if (moved == NULL) {
+        // a failed realloc leaves the block where it was
+        expect(malloc_usable_size(kept) >= 100, "a failed realloc keeps the block");
+    }
+    free(moved ? moved : kept);
+}
+
+/*
+ * check_exhaustion - Caps the address space, then allocates heap sized
+ * blocks until the heap cannot grow. Each function must then fail with
+ * ENOMEM instead of crashing.
+ */
+static void check_exhaustion(void) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL || fscanf(statm, "%ld", &pages) != 1) {
+        printf("FAIL could not read /proc/self/statm\n");
+        failures++;
+        return;
+    }
+    fclose(statm);
+    struct rlimit limit = {pages * 4096 + ADDRESS_SPACE_LEFT, RLIM_INFINITY};
+    if (setrlimit(RLIMIT_AS, &limit) != 0) {
+        printf("FAIL could not limit the address space\n");
+        failures++;
+        return;
+    }
+
+    int result = 0;
+    size_t count = 0;
+    void *ptr;
+    while ((result = posix_memalign(&ptr, 64, 1000)) == 0) {
+        count++;
+    }
+    expect(result == ENOMEM && count > 0, "posix_memalign runs out with ENOMEM");
+    errno = 0;
+    expect(malloc(1000) == NULL && errno == ENOMEM, "malloc runs out with ENOMEM");
+    errno = 0;
+    expect(calloc(10, 100) == NULL && errno == ENOMEM, "calloc runs out with ENOMEM");
+    errno = 0;
+    expect(malloc(1024 * 1024) == NULL && errno == ENOMEM, "a mapped malloc runs out with ENOMEM");
+}
+
+int main(void) {
+    // stdout takes its buffer before the address space runs out
+    printf("interpose_test\n");
+    check_alignments();
+    check_oversize();
+    check_exhaustion();
+    printf("%s\n", (failures == 0) ? "all passed" : "failed");
+    return failures != 0;
+}
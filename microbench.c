@@ -0,0 +1,403 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * microbench.c - Times the steps of the heap on their own, find, split,
+ * update_list, coalesce and extend, on heaps built with a free list of a
+ * chosen length and shape, and prints how each cost grows with the length.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "csbrk.h"
+#include "support.h"
+
+#define DEFAULT_MAX_LENGTH 4096
+#define DEFAULT_REPS 1000
+#define DEFAULT_SIZE 1024
+#define GUARD_SIZE (SLAB_MAX_SIZE + ALIGNMENT)  /* the smallest heap payload */
+#define EXTEND_MAX_REPS 100                     /* every call keeps its memory */
+
+/*
+ * The size find is timed on. A block handed out whole may be up to ALIGNMENT
+ * larger than asked, so the probe stays clear of every other free block.
+ */
+#define PROBE_SIZE (block_size + 2 * ALIGNMENT)
+
+extern memory_block_t *seg_lists[FL_INDEX_COUNT][SL_INDEX_COUNT];
+
+/*
+ * Where the one free block that fits the probed size sits: at the head of
+ * the probe's list, at the tail of the part of the list past the fit index,
+ * which find can only walk, or in a larger list that the rounded up bitmap
+ * search reaches first. The fit index holds the first FIT_INDEX_SLOTS blocks
+ * freed, so up to that many free blocks every fit is found in the index.
+ */
+typedef enum {FIT_HEAD, FIT_TAIL, FIT_ABOVE, NUM_FITS} fit_t;
+static const char *fit_names[NUM_FITS] = {"find-head", "find-tail", "find-above"};
+
+/*
+ * A built heap: length free blocks, each followed by an allocated guard so
+ * none of them can coalesce, freed in address order so that the list holds
+ * the last one first. fit is the free block the probe fits.
+ */
+typedef struct {
+    memory_block_t **free_blocks;
+    memory_block_t **guards;
+    memory_block_t *fit;
+    size_t length;
+} heap_t;
+
+static size_t reps = DEFAULT_REPS;
+static size_t block_size = DEFAULT_SIZE;    /* payload of every other free block */
+static bool spread = false;                 /* other free blocks spread over smaller sizes */
+static uint64_t overhead;                   /* of a pair of clock reads */
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: microbench [-h] [-n length] [-r reps] [-s size] [-d fixed|spread]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n length  Longest free list, the sweep doubles up to it (default %d).\n",
+            DEFAULT_MAX_LENGTH);
+    fprintf(stderr, "\t-r reps    Calls timed at each point, the median is printed (default %d).\n", DEFAULT_REPS);
+    fprintf(stderr, "\t-s size    Payload of the free blocks; the probe asks for 2 * ALIGNMENT more\n");
+    fprintf(stderr, "\t           and must fall in the same list (default %d).\n", DEFAULT_SIZE);
+    fprintf(stderr, "\t-d dist    fixed keeps every free block in the probe's list, spread draws\n");
+    fprintf(stderr, "\t           their sizes evenly below the probe (default fixed).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/*
+ * timer_overhead - The least time seen between two back to back clock reads,
+ * which is taken off every sample.
+ */
+static uint64_t timer_overhead(void) {
+    uint64_t least = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = now_ns();
+        uint64_t delta = now_ns() - start;
+        least = (delta < least) ? delta : least;
+    }
+    return least;
+}
+
+static uint64_t elapsed(uint64_t start) {
+    uint64_t delta = now_ns() - start;
+    return (delta > overhead) ? delta - overhead : 0;
+}
+
+static int compare_samples(const void *a, const void *b) {
+    uint64_t left = *(uint64_t *) a, right = *(uint64_t *) b;
+    return (left > right) - (left < right);
+}
+
+static uint64_t median(uint64_t *samples, size_t count) {
+    qsort(samples, count, sizeof(uint64_t), compare_samples);
+    return samples[count / 2];
+}
+
+/*
+ * drain_heap - Marks every free block in the lists allocated, so that the
+ * blocks freed after it are the only free ones, the top of the heap
+ * included.
+ */
+static void drain_heap(void) {
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            while (seg_lists[fl][sl] != NULL) {
+                memory_block_t *block = seg_lists[fl][sl];
+                remove_free_block(block);
+                allocate(block);
+                set_prev_allocated(get_next_block(block), true);
+            }
+        }
+    }
+}
+
+/*
+ * other_size - The payload of a free block the probe does not fit: block_size,
+ * or with spread any heap size below the probe.
+ */
+static size_t other_size(void) {
+    if (!spread) {
+        return block_size;
+    }
+    size_t choices = (block_size - GUARD_SIZE) / ALIGNMENT + 1;
+    return GUARD_SIZE + (rand() % choices) * ALIGNMENT;
+}
+
+/*
+ * build_heap - Starts a new heap holding only length free blocks, one of
+ * them the fit of the probe, placed as fit says. The rest of the heap is
+ * allocated.
+ */
+static heap_t build_heap(size_t length, fit_t fit) {
+    heap_t heap = {malloc(length * sizeof(memory_block_t *)), malloc(length * sizeof(memory_block_t *)), NULL,
+                   length};
+    assert(heap.free_blocks != NULL && heap.guards != NULL);
+    if (uinit() == -1) {
+        appl_error("uinit failed.");
+    }
+    // the list holds the last block freed first, the index the first ones
+    size_t fit_index = (fit == FIT_HEAD) ? length - 1 : (length > FIT_INDEX_SLOTS) ? FIT_INDEX_SLOTS : 0;
+    for (size_t i = 0; i < length; i++) {
+        size_t size = other_size();
+        if (i == fit_index) {
+            size = (fit == FIT_ABOVE) ? 2 * block_size : PROBE_SIZE;
+        }
+        void *payload = umalloc(size);
+        void *guard = umalloc(GUARD_SIZE);
+        if (payload == NULL || guard == NULL) {
+            appl_error("umalloc failed building the heap.");
+        }
+        heap.free_blocks[i] = get_block(payload);
+        heap.guards[i] = get_block(guard);
+    }
+    drain_heap();
+    for (size_t i = 0; i < length; i++) {
+        ufree(get_payload(heap.free_blocks[i]));
+    }
+    heap.fit = heap.free_blocks[fit_index];
+    return heap;
+}
+
+static void free_heap(heap_t *heap) {
+    free(heap->free_blocks);
+    free(heap->guards);
+}
+
+/*
+ * time_find - The median time find takes for the probe. find leaves the
+ * heap as it was, but for filling the fit index on the first call, which is
+ * made untimed.
+ */
+static uint64_t time_find(heap_t *heap, uint64_t *samples) {
+    if (find(PROBE_SIZE) != heap->fit) {
+        appl_error("find did not return the block built to fit.");
+    }
+    for (size_t rep = 0; rep < reps; rep++) {
+        uint64_t start = now_ns();
+        find(PROBE_SIZE);
+        samples[rep] = elapsed(start);
+    }
+    return median(samples, reps);
+}
+
+/*
+ * time_split - The median time to split the last free block in half. The
+ * halves are coalesced back, untimed, after each call.
+ */
+static uint64_t time_split(heap_t *heap, uint64_t *samples) {
+    memory_block_t *block = heap->free_blocks[heap->length - 1];
+    size_t size = get_size(block);
+    size_t half = ALIGN(size / 2) + ALIGNMENT;
+    bool prev_alloc = is_prev_allocated(block);
+    for (size_t rep = 0; rep < reps; rep++) {
+        uint64_t start = now_ns();
+        split(block, half);
+        samples[rep] = elapsed(start);
+
+        put_block(block, half - ALIGNMENT, false);
+        set_prev_allocated(block, prev_alloc);
+        put_footer(block);
+        coalesce(block);
+    }
+    assert(get_size(block) == size);
+    return median(samples, reps);
+}
+
+/*
+ * time_update_list - The median time to take the last free block out of its
+ * list and put it back, the list work of a split. It is the highest block, so
+ * address ordered lists walk all of theirs to put it back.
+ */
+static uint64_t time_update_list(heap_t *heap, uint64_t *samples) {
+    memory_block_t *block = heap->free_blocks[heap->length - 1];
+    for (size_t rep = 0; rep < reps; rep++) {
+        uint64_t start = now_ns();
+        update_list(block, block);
+        samples[rep] = elapsed(start);
+    }
+    return median(samples, reps);
+}
+
+/*
+ * time_coalesce - The median time to free the guard between the last two
+ * free blocks and merge all three. The three are rebuilt, untimed, after
+ * each call. Needs two free blocks.
+ */
+static uint64_t time_coalesce(heap_t *heap, uint64_t *samples) {
+    memory_block_t *before = heap->free_blocks[heap->length - 2];
+    memory_block_t *guard = heap->guards[heap->length - 2];
+    memory_block_t *after = heap->free_blocks[heap->length - 1];
+    size_t before_size = get_size(before), guard_size = get_size(guard), after_size = get_size(after);
+    bool prev_alloc = is_prev_allocated(before);
+    for (size_t rep = 0; rep < reps; rep++) {
+        put_block(guard, guard_size, false);
+        set_prev_allocated(guard, false);
+        put_footer(guard);
+        uint64_t start = now_ns();
+        memory_block_t *merged = coalesce(guard);
+        samples[rep] = elapsed(start);
+
+        assert(merged == before);
+        remove_free_block(merged);
+        put_block(before, before_size, false);
+        set_prev_allocated(before, prev_alloc);
+        put_footer(before);
+        put_block(guard, guard_size, true);
+        set_prev_allocated(guard, false);
+        put_block(after, after_size, false);
+        set_prev_allocated(after, true);
+        put_footer(after);
+        set_prev_allocated(get_next_block(after), false);
+        insert_free_block(before);
+        insert_free_block(after);
+    }
+    return median(samples, reps);
+}
+
+/*
+ * time_extend - The median time extend takes to grow the heap by size bytes
+ * on a fresh heap, the csbrk call included. The new blocks are left out of
+ * the lists, the next uinit starts over, and since the memory is never given
+ * back only a few calls are made.
+ */
+static uint64_t time_extend(size_t size, uint64_t *samples) {
+    size_t count = (reps < EXTEND_MAX_REPS) ? reps : EXTEND_MAX_REPS;
+    if (uinit() == -1) {
+        appl_error("uinit failed.");
+    }
+    for (size_t rep = 0; rep < count; rep++) {
+        uint64_t start = now_ns();
+        extend(size);
+        samples[rep] = elapsed(start);
+    }
+    return median(samples, count);
+}
+
+/*
+ * print_knee - Prints the first length at which a step took more than twice
+ * as long as with a single free block, where its linear part starts to show.
+ */
+static void print_knee(const char *name, uint64_t *times, size_t *lengths, int points) {
+    for (int point = 1; point < points; point++) {
+        if (times[point] > 2 * times[0] && times[point] > times[0] + 10) {
+            printf("%-12s takes over twice as long from %zu free blocks\n", name, lengths[point]);
+            return;
+        }
+    }
+    printf("%-12s stays flat up to %zu free blocks\n", name, lengths[points - 1]);
+}
+
+int main(int argc, char **argv) {
+    char c;
+    size_t max_length = DEFAULT_MAX_LENGTH;
+
+    while ((c = getopt(argc, argv, "d:hn:r:s:")) != EOF) {
+        switch (c) {
+        case 'd':
+            if (strcmp(optarg, "spread") == 0) {
+                spread = true;
+            } else if (strcmp(optarg, "fixed") != 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'n':
+            max_length = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            reps = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            block_size = ALIGN(strtoul(optarg, NULL, 10));
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (max_length < 1 || reps < 1) {
+        usage();
+        appl_error("Length and reps must be positive.");
+    }
+    int fl, sl, probe_fl, probe_sl;
+    mapping_insert(block_size, &fl, &sl);
+    mapping_insert(PROBE_SIZE + ALIGNMENT, &probe_fl, &probe_sl);
+    if (block_size <= GUARD_SIZE || 2 * block_size >= MMAP_THRESHOLD || fl != probe_fl || sl != probe_sl) {
+        usage();
+        appl_error("Size must be above the slab sizes, below half the mapping threshold and share a list with the probe.");
+    }
+
+    enum {FIND_HEAD, FIND_TAIL, FIND_ABOVE, SPLIT, UPDATE_LIST, COALESCE, NUM_STEPS};
+    const char *step_names[NUM_STEPS] = {fit_names[FIT_HEAD], fit_names[FIT_TAIL], fit_names[FIT_ABOVE], "split",
+                                         "update_list", "coalesce"};
+    int points = 0;
+    while ((1UL << points) <= max_length) {
+        points++;
+    }
+    size_t lengths[points];
+    uint64_t times[NUM_STEPS][points];
+    uint64_t *samples = malloc(reps * sizeof(uint64_t));
+    assert(samples != NULL);
+    overhead = timer_overhead();
+    srand(1);
+
+    printf("median ns per call, free blocks of %zuB (%s), probe %zuB\n", block_size, spread ? "spread" : "fixed",
+           PROBE_SIZE);
+    printf("%-10s", "free list");
+    for (int step = 0; step < NUM_STEPS; step++) {
+        printf(" %12s", step_names[step]);
+    }
+    printf("\n");
+    for (int point = 0; point < points; point++) {
+        lengths[point] = 1UL << point;
+        for (fit_t fit = 0; fit < NUM_FITS; fit++) {
+            heap_t heap = build_heap(lengths[point], fit);
+            times[fit][point] = time_find(&heap, samples);
+            if (fit == FIT_TAIL) {
+                times[SPLIT][point] = time_split(&heap, samples);
+                times[UPDATE_LIST][point] = time_update_list(&heap, samples);
+                times[COALESCE][point] = (heap.length >= 2) ? time_coalesce(&heap, samples) : 0;
+            }
+            free_heap(&heap);
+        }
+        printf("%-10zu", lengths[point]);
+        for (int step = 0; step < NUM_STEPS; step++) {
+            printf(" %12lu", times[step][point]);
+        }
+        printf("\n");
+    }
+
+    printf("\n");
+    for (int step = 0; step < NUM_STEPS; step++) {
+        if (step == COALESCE) {
+            // there is no pair to merge with a single free block
+            if (points > 1) {
+                print_knee(step_names[step], times[step] + 1, lengths + 1, points - 1);
+            }
+            continue;
+        }
+        print_knee(step_names[step], times[step], lengths, points);
+    }
+
+    printf("\n%-10s %12s\n", "extend (B)", "ns");
+    for (size_t size = GROWTH_GRANULE; size <= PAGESIZE * ALIGNMENT; size *= 2) {
+        size_t grow = (size < PAGESIZE * ALIGNMENT) ? size : PAGESIZE * ALIGNMENT - ALIGNMENT * 2;
+        printf("%-10zu %12lu\n", grow, time_extend(grow, samples));
+    }
+
+    free(samples);
+    return 0;
+}
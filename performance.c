@@ -1,29 +1,230 @@
 /**************************************************************************
  * C S 429 MM-lab
- * 
+ *
  * performance.c - Runs the traces and evaluates the umalloc package for performance
- * 
+ *
  * Copyright (c) 2021 M. Hinton. All rights reserved.
  * May not be used, modified, or copied without permission.
  **************************************************************************/
 
 #include "umalloc.h"
 #include "support.h"
+#include "backend.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Latency mode times every op on its own and files it in a log bucketed
+ * histogram: each power of two is split into 1 << SUB_BUCKETS_LOG2 buckets,
+ * so a percentile read back from the buckets is within 25% of the real one.
+ */
+#define SUB_BUCKETS_LOG2 2
+#define NUM_BUCKETS (64 << SUB_BUCKETS_LOG2)
+#define NUM_OP_TYPES 3
+#define NUM_SIZE_CLASSES 7
+#define ALL_SIZES NUM_SIZE_CLASSES      /* histogram row covering every size */
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;                     /* cycles, for the mean */
+    uint64_t max;
+    uint64_t buckets[NUM_BUCKETS];
+} histogram_t;
+
+static const char *op_names[NUM_OP_TYPES] = {"umalloc", "ufree", "urealloc"};
+static const char *size_class_names[NUM_SIZE_CLASSES + 1] = {
+    "1-64", "65-256", "257-1K", "1K-4K", "4K-16K", "16K-64K", "64K+", "all"
+};
+static histogram_t histograms[NUM_OP_TYPES][NUM_SIZE_CLASSES + 1];
+static double ns_per_cycle;
+static const backend_t *backend;        /* the allocator the trace runs on */
+
+/*
+ * Comparing backends replays the trace on each of them COMPARE_ROUNDS times
+ * and keeps the fastest, then once more untimed to find the peak footprint.
+ * Every replay runs in a child of its own, so the backends never share a
+ * heap and each starts as clean as the first.
+ */
+#define COMPARE_ROUNDS 5
+
+typedef struct {
+    uint64_t replay_ns;     /* the fastest round, uinit included */
+    size_t peak;            /* the most bytes held from the system at once */
+    bool passed;
+} backend_result_t;
+
+/*
+ * Counter mode reads these through perf_event_open, user space only. When the
+ * hardware has no counters to give, as in most VMs, the software ones are
+ * counted instead.
+ */
+#define MAX_COUNTERS 6
+#define HW_CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_event_t;
+
+static const counter_event_t hardware_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d-misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC-misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB-misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+static const counter_event_t software_events[] = {
+    {"task-clock(ns)", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+/* One set of counters, enabled and disabled together through the leader */
+typedef struct {
+    const counter_event_t *events;
+    int num_events;
+    int fds[MAX_COUNTERS];              /* -1 for events that failed to open */
+    int leader;
+} counter_group_t;
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: performance [-hlps] [-o file] [-b backend] file\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-l         Time every op and report latency percentiles.\n");
+    fprintf(stderr, "\t-o file    Also write the latencies to file, as JSON if it ends\n");
+    fprintf(stderr, "\t           in .json and as CSV otherwise. Implies -l.\n");
+    fprintf(stderr, "\t-p         Count cache, TLB and branch misses with perf_event_open,\n");
+    fprintf(stderr, "\t           for the whole replay and per op type.\n");
+    fprintf(stderr, "\t-s         Print the allocator statistics after the replay.\n");
+    fprintf(stderr, "\t-b backend Replay on another allocator, or on all of them side by side:\n");
+    for (int i = 0; i < num_backends; i++) {
+        fprintf(stderr, "\t           %-8s %s\n", backends[i].name, backends[i].description);
+    }
+    fprintf(stderr, "\t           %-8s %s\n", "all", "compare umalloc with every other backend");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+/*
+ * read_cycles - A cheap timestamp. Uses the time stamp counter where there is
+ * one, fenced so the timed call cannot drift across it, and the monotonic
+ * clock in nanoseconds elsewhere.
+ */
+static inline uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+#endif
+}
+
+/*
+ * timer_overhead - The fewest cycles seen between two back to back reads,
+ * which is subtracted from every sample.
+ */
+static uint64_t timer_overhead(void) {
+    uint64_t least = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = read_cycles();
+        uint64_t delta = read_cycles() - start;
+        least = (delta < least) ? delta : least;
+    }
+    return least;
+}
+
+/*
+ * size_class - The histogram row for a request of size bytes, one per power
+ * of four.
+ */
+static int size_class(size_t size) {
+    int size_class = 0;
+    for (size_t limit = 64; size > limit && size_class < NUM_SIZE_CLASSES - 1; limit *= 4) {
+        size_class++;
+    }
+    return size_class;
+}
+
+/*
+ * bucket_index - The histogram bucket for a sample. Samples below
+ * 1 << SUB_BUCKETS_LOG2 get a bucket each.
+ */
+static int bucket_index(uint64_t cycles) {
+    if (cycles < (1 << SUB_BUCKETS_LOG2)) {
+        return cycles;
+    }
+    int msb = 63 - __builtin_clzll(cycles);
+    int sub = (cycles >> (msb - SUB_BUCKETS_LOG2)) & ((1 << SUB_BUCKETS_LOG2) - 1);
+    return ((msb - SUB_BUCKETS_LOG2 + 1) << SUB_BUCKETS_LOG2) + sub;
+}
+
+/*
+ * bucket_upper - The largest sample that lands in a bucket.
+ */
+static uint64_t bucket_upper(int index) {
+    if (index < (1 << SUB_BUCKETS_LOG2)) {
+        return index;
+    }
+    int msb = (index >> SUB_BUCKETS_LOG2) + SUB_BUCKETS_LOG2 - 1;
+    int sub = index & ((1 << SUB_BUCKETS_LOG2) - 1);
+    uint64_t width = 1UL << (msb - SUB_BUCKETS_LOG2);
+    return (1UL << msb) + sub * width + width - 1;
+}
+
+static void record(histogram_t *histogram, uint64_t cycles) {
+    histogram->count++;
+    histogram->total += cycles;
+    histogram->max = (cycles > histogram->max) ? cycles : histogram->max;
+    histogram->buckets[bucket_index(cycles)]++;
+}
+
+/*
+ * percentile_ns - The latency below which the given fraction of the samples
+ * fall, read as the top of the bucket it lands in and capped at the max.
+ */
+static double percentile_ns(histogram_t *histogram, double fraction) {
+    uint64_t rank = (uint64_t) (fraction * histogram->count);
+    rank = (rank < histogram->count) ? rank : histogram->count - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            uint64_t upper = bucket_upper(i);
+            return ((upper < histogram->max) ? upper : histogram->max) * ns_per_cycle;
+        }
+    }
+    return histogram->max * ns_per_cycle;
+}
 
 static void run_trace(trace_t *trace) {
 
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
-    uinit();
+    backend->init();
     for(size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
         if (curr_op % 5 == 0) {
             sbrk(4096);
         }
         traceop_t op = trace->ops[curr_op];
         if (op.type == ALLOC) {
-            trace->blocks[op.index].payload = umalloc(op.size);
+            trace->blocks[op.index].payload = backend->malloc(op.size);
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = backend->realloc(trace->blocks[op.index].payload, op.size);
         } else {
-            ufree(trace->blocks[op.index].payload);
+            backend->free(trace->blocks[op.index].payload);
         }
     }
     clock_gettime(CLOCK_MONOTONIC, &end);
@@ -31,15 +232,492 @@ static void run_trace(trace_t *trace) {
     printf("Success: %ld", delta_us);
 }
 
+/*
+ * run_trace_latency - Replays the trace like run_trace, but times each op on
+ * its own, leaving uinit and the injected sbrk calls out of the samples. The
+ * cycle counter is calibrated against the monotonic clock over the replay.
+ */
+static void run_trace_latency(trace_t *trace) {
+    uint64_t overhead = timer_overhead();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t start_cycles = read_cycles();
+    backend->init();
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        allocated_block_t *block = &trace->blocks[op.index];
+        uint64_t before = read_cycles();
+        if (op.type == ALLOC) {
+            block->payload = backend->malloc(op.size);
+        } else if (op.type == REALLOC) {
+            block->payload = backend->realloc(block->payload, op.size);
+        } else {
+            backend->free(block->payload);
+        }
+        uint64_t cycles = read_cycles() - before;
+        cycles = (cycles > overhead) ? cycles - overhead : 0;
+
+        // frees are filed under the size the block was allocated with
+        if (op.type != FREE) {
+            block->block_size = op.size;
+        }
+        record(&histograms[op.type][size_class(block->block_size)], cycles);
+        record(&histograms[op.type][ALL_SIZES], cycles);
+    }
+    uint64_t end_cycles = read_cycles();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t delta_ns = (end.tv_sec - start.tv_sec) * 1000000000UL + (end.tv_nsec - start.tv_nsec);
+    ns_per_cycle = (double) delta_ns / (end_cycles - start_cycles ? end_cycles - start_cycles : 1);
+    printf("Success: %ld\n", delta_ns / 1000);
+}
+
+/*
+ * open_counters - Opens every event it can as one group, disabled. Returns
+ * the number opened; events the CPU or kernel refuses are left out.
+ */
+static int open_counters(counter_group_t *group, const counter_event_t *events, int num_events) {
+    group->events = events;
+    group->num_events = num_events;
+    group->leader = -1;
+    int opened = 0;
+    for (int i = 0; i < num_events; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = (group->leader == -1);
+        attr.exclude_kernel = (events[i].type != PERF_TYPE_SOFTWARE);
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        group->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, group->leader, 0);
+        if (group->fds[i] != -1) {
+            group->leader = (group->leader == -1) ? group->fds[i] : group->leader;
+            opened++;
+        }
+    }
+    return opened;
+}
+
+static void enable_counters(counter_group_t *group) {
+    ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void disable_counters(counter_group_t *group) {
+    ioctl(group->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * read_counter - Reads one event, scaled up if the kernel had to share the
+ * hardware counters and only ran it part of the time. Returns -1 if the event
+ * never opened or never ran.
+ */
+static double read_counter(counter_group_t *group, int event) {
+    uint64_t values[3]; /* value, time enabled, time running */
+    if (group->fds[event] == -1 || read(group->fds[event], values, sizeof(values)) != sizeof(values) ||
+        values[2] == 0) {
+        return -1;
+    }
+    return (double) values[0] * values[1] / values[2];
+}
+
+static void close_counters(counter_group_t *group) {
+    for (int i = 0; i < group->num_events; i++) {
+        if (group->fds[i] != -1) {
+            close(group->fds[i]);
+        }
+    }
+}
+
+/*
+ * run_trace_counters - Replays the trace twice. The first replay counts the
+ * whole loop, as run_trace times it. The second enables the counters of the op
+ * type around each op only. Hardware events are counted in user space only,
+ * so the ioctls around each op barely register; software events include them.
+ */
+static void run_trace_counters(trace_t *trace) {
+    counter_group_t whole, by_type[NUM_OP_TYPES];
+    const counter_event_t *events = hardware_events;
+    int num_events = sizeof(hardware_events) / sizeof(hardware_events[0]);
+    if (open_counters(&whole, events, num_events) == 0) {
+        printf("Hardware counters unavailable (%s), counting software events.\n", strerror(errno));
+        events = software_events;
+        num_events = sizeof(software_events) / sizeof(software_events[0]);
+        if (open_counters(&whole, events, num_events) == 0) {
+            printf("Performance counters unavailable (%s).\n", strerror(errno));
+            run_trace(trace);
+            return;
+        }
+    }
+    for (int type = 0; type < NUM_OP_TYPES; type++) {
+        open_counters(&by_type[type], events, num_events);
+    }
 
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    enable_counters(&whole);
+    backend->init();
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        if (op.type == ALLOC) {
+            trace->blocks[op.index].payload = backend->malloc(op.size);
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = backend->realloc(trace->blocks[op.index].payload, op.size);
+        } else {
+            backend->free(trace->blocks[op.index].payload);
+        }
+    }
+    disable_counters(&whole);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Success: %ld\n", (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
 
-int main(int argc, char **argv) { 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: performance file\n");
+    // the second replay starts from a fresh heap, the first one's is abandoned
+    memset(trace->blocks, 0, trace->num_ids * sizeof(allocated_block_t));
+    uint64_t op_counts[NUM_OP_TYPES] = {0};
+    backend->init();
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        counter_group_t *group = &by_type[op.type];
+        op_counts[op.type]++;
+        if (group->leader != -1) {
+            enable_counters(group);
+        }
+        if (op.type == ALLOC) {
+            trace->blocks[op.index].payload = backend->malloc(op.size);
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = backend->realloc(trace->blocks[op.index].payload, op.size);
+        } else {
+            backend->free(trace->blocks[op.index].payload);
+        }
+        if (group->leader != -1) {
+            disable_counters(group);
+        }
+    }
+
+    printf("%-18s %14s", "counter (per op)", "trace");
+    for (int type = 0; type < NUM_OP_TYPES; type++) {
+        if (op_counts[type] != 0) {
+            printf(" %12s", op_names[type]);
+        }
+    }
+    printf("\n");
+    for (int event = 0; event < num_events; event++) {
+        double total = read_counter(&whole, event);
+        if (total < 0) {
+            printf("%-18s %14s", events[event].name, "n/a");
+        } else {
+            printf("%-18s %14.2f", events[event].name, total / trace->num_ops);
+        }
+        for (int type = 0; type < NUM_OP_TYPES; type++) {
+            if (op_counts[type] == 0) {
+                continue;
+            }
+            double count = read_counter(&by_type[type], event);
+            if (count < 0) {
+                printf(" %12s", "n/a");
+            } else {
+                printf(" %12.2f", count / op_counts[type]);
+            }
+        }
+        printf("\n");
+    }
+
+    close_counters(&whole);
+    for (int type = 0; type < NUM_OP_TYPES; type++) {
+        close_counters(&by_type[type]);
+    }
+}
+
+/*
+ * replay_backend - The body of a child replaying the trace once on backend b,
+ * as run_trace does. When sample is set the replay is not timed, and the
+ * bytes held are read after every op instead, for backends that do not keep
+ * their own peak. The result goes back to the parent through fd.
+ */
+static void replay_backend(trace_t *trace, const backend_t *b, bool sample, int fd) {
+    backend_result_t result = {0};
+    size_t held = 0;
+    memset(trace->blocks, 0, trace->num_ids * sizeof(allocated_block_t));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (b->init() == -1) {
+        _exit(1);
+    }
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        if (op.type == ALLOC) {
+            trace->blocks[op.index].payload = b->malloc(op.size);
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = b->realloc(trace->blocks[op.index].payload, op.size);
+        } else {
+            b->free(trace->blocks[op.index].payload);
+        }
+        if (op.type != FREE && trace->blocks[op.index].payload == NULL) {
+            _exit(1);
+        }
+        if (sample && b->peak == NULL && b->held() > held) {
+            held = b->held();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result.replay_ns = (end.tv_sec - start.tv_sec) * 1000000000UL + (end.tv_nsec - start.tv_nsec);
+    result.peak = (b->peak != NULL) ? b->peak() : held;
+    result.passed = true;
+    if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/*
+ * run_backend - Forks a child to replay the trace on backend b and waits for
+ * its result, which is marked not passed if the child fails.
+ */
+static backend_result_t run_backend(trace_t *trace, const backend_t *b, bool sample) {
+    backend_result_t result = {0};
+    int fds[2];
+    if (pipe(fds) == -1) {
+        appl_error("pipe failed.");
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1) {
+        appl_error("fork failed.");
+    } else if (pid == 0) {
+        close(fds[0]);
+        replay_backend(trace, b, sample, fds[1]);
+    }
+    close(fds[1]);
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+        result.passed = false;
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return result;
+}
+
+/*
+ * max_live_bytes - The most payload bytes the trace has allocated at once,
+ * the numerator of runner's utilization.
+ */
+static size_t max_live_bytes(trace_t *trace) {
+    size_t live = 0, max_live = 0;
+    memset(trace->blocks, 0, trace->num_ids * sizeof(allocated_block_t));
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        traceop_t op = trace->ops[curr_op];
+        allocated_block_t *block = &trace->blocks[op.index];
+        live -= block->block_size;
+        block->block_size = (op.type == FREE) ? 0 : op.size;
+        live += block->block_size;
+        max_live = (live > max_live) ? live : max_live;
+    }
+    return max_live;
+}
+
+/*
+ * compare_backends - Replays the trace on every backend and prints their
+ * throughput and peak footprint side by side, then where umalloc falls
+ * between the system malloc, the bump allocator's speed and the oracle's
+ * footprint.
+ */
+static void compare_backends(trace_t *trace) {
+    backend_result_t results[num_backends];
+    size_t max_live = max_live_bytes(trace);
+
+    printf("%-8s %12s %12s %14s %12s\n", "backend", "time (us)", "ops/ms", "peak held (B)", "utilization");
+    for (int i = 0; i < num_backends; i++) {
+        results[i] = run_backend(trace, &backends[i], false);
+        for (int round = 1; round < COMPARE_ROUNDS && results[i].passed; round++) {
+            backend_result_t next = run_backend(trace, &backends[i], false);
+            if (!next.passed || next.replay_ns < results[i].replay_ns) {
+                results[i].replay_ns = next.replay_ns;
+                results[i].passed = next.passed;
+            }
+        }
+        if (results[i].passed) {
+            backend_result_t footprint = run_backend(trace, &backends[i], true);
+            results[i].peak = footprint.peak;
+            results[i].passed = footprint.passed;
+        }
+        if (!results[i].passed) {
+            printf("%-8s %12s\n", backends[i].name, "failed");
+            continue;
+        }
+        printf("%-8s %12.1f %12.0f %14zu %11.2f%%\n", backends[i].name, results[i].replay_ns / 1000.0,
+               trace->num_ops * 1e6 / results[i].replay_ns, results[i].peak,
+               results[i].peak ? 100.0 * max_live / results[i].peak : 0.0);
+    }
+
+    backend_result_t *under_test = &results[0];
+    if (!under_test->passed) {
+        return;
+    }
+    printf("\numalloc relative to the others:\n");
+    for (int i = 1; i < num_backends; i++) {
+        if (!results[i].passed || results[i].peak == 0) {
+            continue;
+        }
+        printf("  vs %-8s %6.2fx the throughput, %6.2fx the peak footprint\n", backends[i].name,
+               (double) results[i].replay_ns / under_test->replay_ns, (double) under_test->peak / results[i].peak);
+    }
+}
+
+/*
+ * print_latencies - Prints the percentiles of every histogram with samples.
+ */
+static void print_latencies(void) {
+    printf("%-9s %-8s %9s %10s %10s %10s %10s %10s\n",
+           "op", "sizes", "count", "mean(ns)", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+    for (int type = 0; type < NUM_OP_TYPES; type++) {
+        for (int sizes = 0; sizes <= NUM_SIZE_CLASSES; sizes++) {
+            histogram_t *histogram = &histograms[type][sizes];
+            if (histogram->count == 0) {
+                continue;
+            }
+            printf("%-9s %-8s %9lu %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                   op_names[type], size_class_names[sizes], histogram->count,
+                   (double) histogram->total / histogram->count * ns_per_cycle,
+                   percentile_ns(histogram, 0.5), percentile_ns(histogram, 0.99),
+                   percentile_ns(histogram, 0.999), histogram->max * ns_per_cycle);
+        }
+    }
+}
+
+/*
+ * export_latencies - Writes the percentiles to a CSV file, or to a JSON file
+ * along with the non-empty buckets of each histogram.
+ */
+static void export_latencies(char *filename) {
+    FILE *out = fopen(filename, "w");
+    if (out == NULL) {
+        appl_error("Could not open the latency output file.");
+    }
+    size_t length = strlen(filename);
+    bool json = length >= 5 && strcmp(filename + length - 5, ".json") == 0;
+
+    if (json) {
+        fprintf(out, "{\"ns_per_cycle\": %f, \"histograms\": [", ns_per_cycle);
+    } else {
+        fprintf(out, "op,sizes,count,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+    bool first = true;
+    for (int type = 0; type < NUM_OP_TYPES; type++) {
+        for (int sizes = 0; sizes <= NUM_SIZE_CLASSES; sizes++) {
+            histogram_t *histogram = &histograms[type][sizes];
+            if (histogram->count == 0) {
+                continue;
+            }
+            double mean = (double) histogram->total / histogram->count * ns_per_cycle;
+            double p50 = percentile_ns(histogram, 0.5);
+            double p99 = percentile_ns(histogram, 0.99);
+            double p999 = percentile_ns(histogram, 0.999);
+            double max = histogram->max * ns_per_cycle;
+            if (!json) {
+                fprintf(out, "%s,%s,%lu,%.1f,%.1f,%.1f,%.1f,%.1f\n", op_names[type],
+                        size_class_names[sizes], histogram->count, mean, p50, p99, p999, max);
+                continue;
+            }
+            fprintf(out, "%s\n  {\"op\": \"%s\", \"sizes\": \"%s\", \"count\": %lu, "
+                    "\"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, "
+                    "\"max_ns\": %.1f, \"buckets\": [", first ? "" : ",", op_names[type],
+                    size_class_names[sizes], histogram->count, mean, p50, p99, p999, max);
+            bool first_bucket = true;
+            for (int i = 0; i < NUM_BUCKETS; i++) {
+                if (histogram->buckets[i] != 0) {
+                    // each bucket as [its largest sample in ns, samples]
+                    fprintf(out, "%s[%.1f, %lu]", first_bucket ? "" : ", ",
+                            bucket_upper(i) * ns_per_cycle, histogram->buckets[i]);
+                    first_bucket = false;
+                }
+            }
+            fprintf(out, "]}");
+            first = false;
+        }
+    }
+    if (json) {
+        fprintf(out, "\n]}\n");
+    }
+    fclose(out);
+}
+
+int main(int argc, char **argv) {
+    char c;
+    bool latency = false, counters = false, stats = false;
+    char *output = NULL, *backend_name = "umalloc";
+
+    while ((c = getopt(argc, argv, "b:hlo:ps")) != EOF) {
+        switch (c) {
+        case 'p':
+            counters = true;
+            break;
+        case 'l':
+            latency = true;
+            break;
+        case 's':
+            stats = true;
+            break;
+        case 'o':
+            latency = true;
+            output = optarg;
+            break;
+        case 'b':
+            backend_name = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage();
         appl_error("No File parameter provided.");
     }
-    trace_t *trace = read_trace(argv[1], 0);
-    run_trace(trace);
+
+    bool compare = strcmp(backend_name, "all") == 0;
+    backend = compare ? &backends[0] : find_backend(backend_name);
+    if (backend == NULL) {
+        usage();
+        appl_error("Unknown backend.");
+    }
+    if (stats && (compare || !backend->native)) {
+        appl_error("Only the umalloc backend, on its own, keeps statistics.");
+    }
+
+    trace_t *trace = read_trace(argv[optind], 0);
+    if (compare) {
+        compare_backends(trace);
+    } else if (counters) {
+        run_trace_counters(trace);
+    } else if (latency) {
+        run_trace_latency(trace);
+        print_latencies();
+        if (output != NULL) {
+            export_latencies(output);
+        }
+    } else {
+        run_trace(trace);
+    }
+    if (stats) {
+        printf("\n");
+        ustats_print(stdout);
+    }
     free_trace(trace);
     return 0;
-}
\ No newline at end of file
+}
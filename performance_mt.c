@@ -0,0 +1,170 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * performance_mt.c - Replays a trace on several threads at once against the
+ * thread safe umalloc build, and reports throughput as the thread count grows.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+#include <pthread.h>
+
+#define DEFAULT_MAX_THREADS 8
+
+/* State for one replaying thread */
+typedef struct {
+    trace_t *trace;                 /* shared, read only */
+    void **payloads;                /* this thread's payload for every id */
+    void **neighbour_payloads;      /* payloads left behind by the next thread */
+    pthread_barrier_t *barrier;
+    struct timespec start, end;     /* when this thread's replay ran */
+} worker_t;
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: performance_mt [-h] [-t threads] file\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-t threads Largest number of threads to replay on (default %d).\n", DEFAULT_MAX_THREADS);
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+/*
+ * run_worker - Replays the whole trace on this thread's own set of ids. Once
+ * every thread is done, frees whatever the next thread left allocated, so the
+ * cross thread free path is exercised even by unbalanced traces.
+ */
+static void *run_worker(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+    trace_t *trace = worker->trace;
+
+    pthread_barrier_wait(worker->barrier);
+    clock_gettime(CLOCK_MONOTONIC, &worker->start);
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        traceop_t op = trace->ops[curr_op];
+        if (op.type == ALLOC) {
+            worker->payloads[op.index] = umalloc(op.size);
+        } else if (op.type == REALLOC) {
+            worker->payloads[op.index] = urealloc(worker->payloads[op.index], op.size);
+        } else {
+            ufree(worker->payloads[op.index]);
+            worker->payloads[op.index] = NULL;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &worker->end);
+
+    // untimed: clean up after the neighbouring thread once it is done
+    pthread_barrier_wait(worker->barrier);
+    for (size_t id = 0; id < trace->num_ids; id++) {
+        ufree(worker->neighbour_payloads[id]);
+    }
+
+    return NULL;
+}
+
+/*
+ * elapsed_us - microseconds from start to end.
+ */
+static int64_t elapsed_us(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * run_threads - Replays the trace on num_threads threads at once. Returns the
+ * wall clock time from the moment the first one starts to the moment the last
+ * one finishes, in microseconds.
+ */
+static uint64_t run_threads(trace_t *trace, int num_threads) {
+    pthread_t threads[num_threads];
+    worker_t workers[num_threads];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].trace = trace;
+        workers[i].payloads = calloc(trace->num_ids, sizeof(void *));
+        if (workers[i].payloads == NULL) {
+            appl_error("Failed to allocate payload array");
+        }
+        workers[i].barrier = &barrier;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].neighbour_payloads = workers[(i + 1) % num_threads].payloads;
+        if (pthread_create(&threads[i], NULL, run_worker, &workers[i]) != 0) {
+            appl_error("pthread_create failed");
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    struct timespec *first_start = &workers[0].start;
+    struct timespec *last_end = &workers[0].end;
+    for (int i = 0; i < num_threads; i++) {
+        if (elapsed_us(&workers[i].start, first_start) > 0) {
+            first_start = &workers[i].start;
+        }
+        if (elapsed_us(last_end, &workers[i].end) > 0) {
+            last_end = &workers[i].end;
+        }
+        free(workers[i].payloads);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    return elapsed_us(first_start, last_end);
+}
+
+int main(int argc, char **argv) {
+    char c;
+    int max_threads = DEFAULT_MAX_THREADS;
+
+    while ((c = getopt(argc, argv, "ht:")) != EOF) {
+        switch (c) {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        appl_error("No File parameter provided.");
+    }
+    if (max_threads < 1) {
+        usage();
+        appl_error("Thread count must be positive.");
+    }
+
+    trace_t *trace = read_trace(argv[optind], 0);
+    if (uinit() == -1) {
+        appl_error("uinit failed.");
+    }
+
+    printf("%8s %12s %12s %8s\n", "threads", "time (us)", "ops/ms", "speedup");
+    double base_ops_per_ms = 0;
+    int num_threads = 1;
+    while (true) {
+        uint64_t delta_us = run_threads(trace, num_threads);
+        double ops_per_ms = (double) trace->num_ops * num_threads * 1000 / (delta_us ? delta_us : 1);
+        if (num_threads == 1) {
+            base_ops_per_ms = ops_per_ms;
+        }
+        printf("%8d %12lu %12.0f %7.2fx\n", num_threads, delta_us, ops_per_ms, ops_per_ms / base_ops_per_ms);
+
+        // double the threads each round, always finishing on the requested count
+        if (num_threads == max_threads) {
+            break;
+        }
+        num_threads = (num_threads * 2 < max_threads) ? num_threads * 2 : max_threads;
+    }
+
+    free_trace(trace);
+    return 0;
+}
@@ -0,0 +1,531 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * record.c - Records the allocations of an unmodified program as a trace
+ * that runner and performance can replay:
+ *
+ *     UMALLOC_TRACE=out.rep LD_PRELOAD=./librecord.so program args...
+ *
+ * The program keeps running on the system malloc. Each block gets the next
+ * id when it is allocated and keeps it across reallocs until it is freed.
+ * Threads log their ops with a global sequence number into private buffers
+ * that are spooled to disk when full, and at exit the spool is put back in
+ * sequence order and written out. A name ending in .bin gets the binary
+ * format, anything else the text one, and %p in the name is replaced by the
+ * process id. The default is trace.%p.rep.
+ **************************************************************************/
+
+#include "support.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define EXPORT __attribute__((visibility("default")))
+#define LOG_RECORDS 8192        /* ops a thread buffers before spooling them */
+#define ID_STRIPES 64           /* independently locked parts of the id table */
+#define ID_TABLE_MIN 1024       /* initial slots in each stripe */
+
+/* The system allocator underneath */
+void *__libc_malloc(size_t size);
+void __libc_free(void *ptr);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+/* One op in a thread log or the spool */
+typedef struct {
+    uint64_t seq;       /* global order of the op */
+    traceop_t op;
+} record_t;
+
+/* A thread's buffer of ops not yet spooled */
+typedef struct thread_log {
+    struct thread_log *next;
+    size_t count;
+    record_t records[LOG_RECORDS];
+} thread_log_t;
+
+/* Maps a live payload to its id */
+typedef struct {
+    void *ptr;          /* NULL for an empty slot */
+    int id;
+} id_entry_t;
+
+/* An open addressed, linearly probed part of the id table */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t capacity;    /* slots, a power of two */
+    size_t count;
+    id_entry_t *entries;
+} id_stripe_t;
+
+static bool recording = false;
+static pid_t owner;                     /* the process whose trace this is */
+static char trace_name[MAXLINE];
+static char spool_name[MAXLINE + 8];
+static int spool_fd = -1;
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_log_t *logs = NULL;       /* every live thread's log */
+static pthread_mutex_t logs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t log_key;
+static uint64_t next_seq = 0;
+static int next_id = 0;
+static id_stripe_t stripes[ID_STRIPES];
+
+static __thread thread_log_t *thread_log __attribute__((tls_model("initial-exec")));
+/* set while the recorder itself runs, so its own allocations are not logged */
+static __thread int depth __attribute__((tls_model("initial-exec")));
+
+/*
+ * hash_ptr - spreads payload addresses, which share their low bits, over the
+ * table. The top bits pick the stripe and the rest the slot.
+ */
+static size_t hash_ptr(void *ptr) {
+    return ((size_t) ptr >> 4) * 0x9e3779b97f4a7c15UL;
+}
+
+static id_stripe_t *get_stripe(size_t hash) {
+    return &stripes[hash >> 58];
+}
+
+/*
+ * grow_stripe - doubles the slots of a stripe and rehashes its entries.
+ * Returns false if there is no memory, leaving the stripe as it was.
+ */
+static bool grow_stripe(id_stripe_t *stripe) {
+    size_t capacity = (stripe->capacity == 0) ? ID_TABLE_MIN : 2 * stripe->capacity;
+    id_entry_t *entries = mmap(NULL, capacity * sizeof(id_entry_t), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (entries == MAP_FAILED) {
+        return false;
+    }
+    for (size_t i = 0; i < stripe->capacity; i++) {
+        id_entry_t entry = stripe->entries[i];
+        if (entry.ptr != NULL) {
+            size_t slot = hash_ptr(entry.ptr) & (capacity - 1);
+            while (entries[slot].ptr != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            entries[slot] = entry;
+        }
+    }
+    if (stripe->entries != NULL) {
+        munmap(stripe->entries, stripe->capacity * sizeof(id_entry_t));
+    }
+    stripe->entries = entries;
+    stripe->capacity = capacity;
+    return true;
+}
+
+/*
+ * put_id - records that ptr has the given id. A stale entry for the same
+ * address, left by a free the recorder never saw, is replaced.
+ */
+static void put_id(void *ptr, int id) {
+    size_t hash = hash_ptr(ptr);
+    id_stripe_t *stripe = get_stripe(hash);
+    pthread_mutex_lock(&stripe->lock);
+    if (2 * (stripe->count + 1) > stripe->capacity && !grow_stripe(stripe)) {
+        pthread_mutex_unlock(&stripe->lock);
+        return;
+    }
+    size_t slot = hash & (stripe->capacity - 1);
+    while (stripe->entries[slot].ptr != NULL && stripe->entries[slot].ptr != ptr) {
+        slot = (slot + 1) & (stripe->capacity - 1);
+    }
+    if (stripe->entries[slot].ptr == NULL) {
+        stripe->count++;
+    }
+    stripe->entries[slot].ptr = ptr;
+    stripe->entries[slot].id = id;
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/*
+ * take_id - removes ptr from the table and returns its id, or -1 if it was
+ * allocated before recording started. Later entries of the probe run are
+ * shifted back over the hole so lookups never stop early.
+ */
+static int take_id(void *ptr) {
+    size_t hash = hash_ptr(ptr);
+    id_stripe_t *stripe = get_stripe(hash);
+    pthread_mutex_lock(&stripe->lock);
+    if (stripe->count == 0) {
+        pthread_mutex_unlock(&stripe->lock);
+        return -1;
+    }
+    size_t mask = stripe->capacity - 1;
+    size_t slot = hash & mask;
+    while (stripe->entries[slot].ptr != ptr) {
+        if (stripe->entries[slot].ptr == NULL) {
+            pthread_mutex_unlock(&stripe->lock);
+            return -1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    int id = stripe->entries[slot].id;
+    size_t hole = slot;
+    for (slot = (hole + 1) & mask; stripe->entries[slot].ptr != NULL; slot = (slot + 1) & mask) {
+        size_t home = hash_ptr(stripe->entries[slot].ptr) & mask;
+        // move the entry back unless its home lies after the hole
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            stripe->entries[hole] = stripe->entries[slot];
+            hole = slot;
+        }
+    }
+    stripe->entries[hole].ptr = NULL;
+    stripe->count--;
+    pthread_mutex_unlock(&stripe->lock);
+    return id;
+}
+
+/*
+ * spool - appends records to the spool file.
+ */
+static void spool(record_t *records, size_t count) {
+    char *buf = (char *) records;
+    size_t left = count * sizeof(record_t);
+    pthread_mutex_lock(&spool_lock);
+    while (left > 0) {
+        ssize_t written = write(spool_fd, buf, left);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "record: lost %zu bytes of trace writing %s\n", left, spool_name);
+            break;
+        }
+        buf += written;
+        left -= written;
+    }
+    pthread_mutex_unlock(&spool_lock);
+}
+
+/*
+ * get_log - returns this thread's log, creating it on the thread's first op.
+ */
+static thread_log_t *get_log(void) {
+    if (thread_log != NULL) {
+        return thread_log;
+    }
+    thread_log_t *log = mmap(NULL, sizeof(thread_log_t), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (log == MAP_FAILED) {
+        return NULL;
+    }
+    pthread_mutex_lock(&logs_lock);
+    log->next = logs;
+    logs = log;
+    pthread_mutex_unlock(&logs_lock);
+    pthread_setspecific(log_key, log);
+    thread_log = log;
+    return log;
+}
+
+/*
+ * close_log - spools what is left of an exiting thread's log and frees it.
+ */
+static void close_log(void *arg) {
+    thread_log_t *log = arg;
+    pthread_mutex_lock(&logs_lock);
+    for (thread_log_t **link = &logs; *link != NULL; link = &(*link)->next) {
+        if (*link == log) {
+            *link = log->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&logs_lock);
+    if (recording && getpid() == owner) {
+        spool(log->records, log->count);
+    }
+    thread_log = NULL;
+    munmap(log, sizeof(thread_log_t));
+}
+
+/*
+ * log_op - logs an op in this thread's log, spooling the log when it fills.
+ */
+static void log_op(int type, int id, size_t size) {
+    thread_log_t *log = get_log();
+    if (log == NULL) {
+        return;
+    }
+    record_t *record = &log->records[log->count++];
+    record->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    record->op.type = type;
+    record->op.index = id;
+    record->op.size = size;
+    if (log->count == LOG_RECORDS) {
+        spool(log->records, log->count);
+        log->count = 0;
+    }
+}
+
+/*
+ * record_alloc - gives a new payload the next id and logs its allocation.
+ * Requests too large for a trace record are not recorded.
+ */
+static void record_alloc(void *ptr, size_t size) {
+    if (ptr == NULL || size > INT32_MAX) {
+        return;
+    }
+    int id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    put_id(ptr, id);
+    log_op(ALLOC, id, size);
+}
+
+/*
+ * record_free - logs the free of a payload that is about to be released,
+ * before another thread can be handed the same address.
+ */
+static void record_free(void *ptr) {
+    int id = take_id(ptr);
+    if (id >= 0) {
+        log_op(FREE, id, 0);
+    }
+}
+
+static bool enter(void) {
+    if (!recording || depth > 0) {
+        return false;
+    }
+    depth++;
+    return true;
+}
+
+static void leave(void) {
+    depth--;
+}
+
+static int compare_seq(const void *a, const void *b) {
+    uint64_t seq_a = ((record_t *) a)->seq;
+    uint64_t seq_b = ((record_t *) b)->seq;
+    return (seq_a > seq_b) - (seq_a < seq_b);
+}
+
+/*
+ * write_trace_text - writes a trace in the text format read_trace() parses.
+ */
+static void write_trace_text(trace_t *trace, char *filename) {
+    FILE *tracefile = fopen(filename, "w");
+    if (tracefile == NULL) {
+        fprintf(stderr, "record: could not open %s\n", filename);
+        return;
+    }
+    fprintf(tracefile, "%d\n%d\n", trace->num_ids, trace->num_ops);
+    for (int i = 0; i < trace->num_ops; i++) {
+        traceop_t op = trace->ops[i];
+        if (op.type == ALLOC) {
+            fprintf(tracefile, "a %d %d\n", op.index, op.size);
+        } else if (op.type == REALLOC) {
+            fprintf(tracefile, "r %d %d\n", op.index, op.size);
+        } else {
+            fprintf(tracefile, "f %d\n", op.index);
+        }
+    }
+    if (fclose(tracefile) != 0) {
+        fprintf(stderr, "record: failed to write %s\n", filename);
+    }
+}
+
+/*
+ * write_trace_out - sorts the spool back into the order the ops happened and
+ * writes it out as the trace.
+ */
+static void write_trace_out(void) {
+    off_t length = lseek(spool_fd, 0, SEEK_END);
+    size_t count = length / sizeof(record_t);
+    if (count == 0) {
+        fprintf(stderr, "record: no allocations to write to %s\n", trace_name);
+        return;
+    }
+    record_t *records = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, spool_fd, 0);
+    if (records == MAP_FAILED) {
+        fprintf(stderr, "record: could not map %s\n", spool_name);
+        return;
+    }
+    qsort(records, count, sizeof(record_t), compare_seq);
+
+    trace_t trace;
+    memset(&trace, 0, sizeof(trace));
+    trace.num_ops = count;
+    trace.ops = malloc(count * sizeof(traceop_t));
+    if (trace.ops == NULL) {
+        fprintf(stderr, "record: no memory to write %s\n", trace_name);
+        munmap(records, length);
+        return;
+    }
+    // ids taken by threads racing with exit may never have been logged
+    for (size_t i = 0; i < count; i++) {
+        trace.ops[i] = records[i].op;
+        if (trace.ops[i].index >= trace.num_ids) {
+            trace.num_ids = trace.ops[i].index + 1;
+        }
+    }
+    munmap(records, length);
+
+    size_t name_length = strlen(trace_name);
+    if (name_length > 4 && strcmp(trace_name + name_length - 4, ".bin") == 0) {
+        write_trace_binary(&trace, trace_name);
+    } else {
+        write_trace_text(&trace, trace_name);
+    }
+    free(trace.ops);
+}
+
+/*
+ * stop_in_child - a forked child keeps running on the system malloc without
+ * recording, and never writes its parent's trace.
+ */
+static void stop_in_child(void) {
+    recording = false;
+}
+
+/*
+ * start - opens the spool and starts recording when the library is loaded.
+ */
+__attribute__((constructor)) static void start(void) {
+    char *pattern = getenv("UMALLOC_TRACE");
+    if (pattern == NULL || pattern[0] == '\0') {
+        pattern = "trace.%p.rep";
+    }
+    owner = getpid();
+    size_t length = 0;
+    for (char *c = pattern; *c != '\0' && length < MAXLINE - 16; c++) {
+        if (c[0] == '%' && c[1] == 'p') {
+            length += sprintf(trace_name + length, "%d", (int) owner);
+            c++;
+        } else {
+            trace_name[length++] = *c;
+        }
+    }
+    trace_name[length] = '\0';
+    sprintf(spool_name, "%s.spool", trace_name);
+
+    spool_fd = open(spool_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (spool_fd < 0) {
+        fprintf(stderr, "record: could not open %s, not recording\n", spool_name);
+        return;
+    }
+    for (int i = 0; i < ID_STRIPES; i++) {
+        pthread_mutex_init(&stripes[i].lock, NULL);
+    }
+    pthread_key_create(&log_key, close_log);
+    pthread_atfork(NULL, NULL, stop_in_child);
+    recording = true;
+}
+
+/*
+ * finish - spools every thread's log and writes the trace at exit. Ops that
+ * threads make while this runs are not recorded.
+ */
+__attribute__((destructor)) static void finish(void) {
+    if (!recording || getpid() != owner) {
+        return;
+    }
+    depth++;
+    recording = false;
+    pthread_mutex_lock(&logs_lock);
+    for (thread_log_t *log = logs; log != NULL; log = log->next) {
+        spool(log->records, log->count);
+        log->count = 0;
+    }
+    pthread_mutex_unlock(&logs_lock);
+
+    write_trace_out();
+    close(spool_fd);
+    unlink(spool_name);
+    depth--;
+}
+
+EXPORT void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    if (enter()) {
+        record_alloc(ptr, size);
+        leave();
+    }
+    return ptr;
+}
+
+EXPORT void free(void *ptr) {
+    if (ptr != NULL && enter()) {
+        record_free(ptr);
+        leave();
+    }
+    __libc_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    void *ptr = __libc_calloc(nmemb, size);
+    if (enter()) {
+        record_alloc(ptr, nmemb * size);
+        leave();
+    }
+    return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (!enter()) {
+        return __libc_realloc(ptr, size);
+    }
+    int id = (ptr == NULL) ? -1 : take_id(ptr);
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (new_ptr == NULL && size != 0) {
+        // the old block is still there, unchanged
+        if (id >= 0) {
+            put_id(ptr, id);
+        }
+    } else if (new_ptr == NULL) {
+        if (id >= 0) {
+            log_op(FREE, id, 0);
+        }
+    } else if (id >= 0 && size <= INT32_MAX) {
+        put_id(new_ptr, id);
+        log_op(REALLOC, id, size);
+    } else {
+        if (id >= 0) {
+            log_op(FREE, id, 0);
+        }
+        record_alloc(new_ptr, size);
+    }
+    leave();
+    return new_ptr;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, total);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    if (enter()) {
+        record_alloc(ptr, size);
+        leave();
+    }
+    return ptr;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
@@ -11,11 +11,20 @@
 #include "csbrk.h"
 #include "support.h"
 #include "check_heap.h"
+#include "backend.h"
 #include <sys/mman.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 int verbose = 0;
-char msg[MAXLINE];      /* for whenever we need to compose an error message */
+int print_stats = 0;
+int incremental = 0;        /* check only the blocks next to each op's block */
+size_t sweep_interval = 0;  /* ops between full checks when incremental, 0 for only at the end */
+const backend_t *backend;   /* the allocator the trace runs on */
+static char msg[MAXLINE]; /* for whenever we need to compose an error message */
 extern size_t sbrk_bytes;
+extern size_t held_bytes;
 extern const char author[];
 
 /* 
@@ -23,13 +32,20 @@ extern const char author[];
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: runner [-rhvuc] file\n");
+    fprintf(stderr, "Usage: runner [-rhvucs] [-i n] [-b backend] file\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-r         Run the trace to completion (bypass interface).\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-v         Print additional debug info.\n");
-    fprintf(stderr, "\t-u         Display heap utilization.\n");
+    fprintf(stderr, "\t-u         Display heap utilization, and the bytes still held after utrim.\n");
     fprintf(stderr, "\t-c         Runs the user provided heap check after every op.\n");
+    fprintf(stderr, "\t-s         Print the allocator statistics once the trace is done.\n");
+    fprintf(stderr, "\t-i n       After each op check only the blocks next to it in memory, and check\n");
+    fprintf(stderr, "\t           every block, and the heap with -c, every n ops (0 only at the end).\n");
+    fprintf(stderr, "\t-b backend Run on another allocator, to compare against umalloc:\n");
+    for (int i = 0; i < num_backends; i++) {
+        fprintf(stderr, "\t           %-8s %s\n", backends[i].name, backends[i].description);
+    }
 }
 
 /* 
@@ -38,18 +54,48 @@ static void usage(void)
  */
 static void copy_id(size_t *block, size_t block_size, size_t id) {
     size_t words = block_size/ sizeof(size_t);
-    for(size_t i = 0; i < words; i++) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i pattern = _mm256_set1_epi64x(id);
+    for (; i + 4 <= words; i += 4) {
+        _mm256_storeu_si256((__m256i *) (block + i), pattern);
+    }
+#elif defined(__SSE2__)
+    __m128i pattern = _mm_set1_epi64x(id);
+    for (; i + 2 <= words; i += 2) {
+        _mm_storeu_si128((__m128i *) (block + i), pattern);
+    }
+#endif
+    for(; i < words; i++) {
         block[i] = id;
     }
 }
 
 /* 
  * check_id - Checks the block contains the block id, repeated the number of
- * words can fit.
+ * words can fit. The words are compared a vector at a time where possible.
  */
 static int check_id(size_t *block, size_t block_size, size_t id) {
     size_t words = block_size/ sizeof(size_t);
-    for(size_t i = 0; i < words; i++) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i pattern = _mm256_set1_epi64x(id);
+    for (; i + 4 <= words; i += 4) {
+        __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (block + i)), pattern);
+        if (!_mm256_testz_si256(diff, diff)) {
+            return -1;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i pattern = _mm_set1_epi64x(id);
+    for (; i + 2 <= words; i += 2) {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) (block + i)), pattern);
+        if (_mm_movemask_epi8(equal) != 0xffff) {
+            return -1;
+        }
+    }
+#endif
+    for(; i < words; i++) {
         if (block[i] != id) {
             return -1;
         }
@@ -58,6 +104,122 @@ static int check_id(size_t *block, size_t block_size, size_t id) {
     return 0;
 }
 
+/*
+ * The live blocks in payload address order, kept in a treap over the block
+ * ids so each op can find the blocks next to the one it touched. Ties in
+ * address, from zero sized payloads, are broken by id.
+ */
+static allocated_block_t *addr_blocks;
+static int *addr_left;
+static int *addr_right;
+static int *addr_priority;
+static int addr_root = -1;
+
+static void addr_init(trace_t *trace) {
+    addr_blocks = trace->blocks;
+    addr_left = malloc(trace->num_ids * sizeof(int));
+    addr_right = malloc(trace->num_ids * sizeof(int));
+    addr_priority = malloc(trace->num_ids * sizeof(int));
+    if (addr_left == NULL || addr_right == NULL || addr_priority == NULL) {
+        appl_error("malloc failed in addr_init.");
+    }
+    for (size_t id = 0; id < trace->num_ids; id++) {
+        addr_priority[id] = rand();
+    }
+}
+
+/*
+ * addr_less - true if block id sorts before the payload at addr of block key_id.
+ */
+static bool addr_less(int id, uintptr_t addr, int key_id) {
+    uintptr_t payload = (uintptr_t) addr_blocks[id].payload;
+    return payload < addr || (payload == addr && id < key_id);
+}
+
+/*
+ * addr_split - splits the treap at node into the blocks before (addr, id),
+ * put in low, and the rest, put in high.
+ */
+static void addr_split(int node, uintptr_t addr, int id, int *low, int *high) {
+    if (node < 0) {
+        *low = *high = -1;
+    } else if (addr_less(node, addr, id)) {
+        addr_split(addr_right[node], addr, id, &addr_right[node], high);
+        *low = node;
+    } else {
+        addr_split(addr_left[node], addr, id, low, &addr_left[node]);
+        *high = node;
+    }
+}
+
+/*
+ * addr_merge - joins two treaps, all of low sorting before all of high.
+ */
+static int addr_merge(int low, int high) {
+    if (low < 0 || high < 0) {
+        return (low < 0) ? high : low;
+    }
+    if (addr_priority[low] > addr_priority[high]) {
+        addr_right[low] = addr_merge(addr_right[low], high);
+        return low;
+    }
+    addr_left[high] = addr_merge(low, addr_left[high]);
+    return high;
+}
+
+static void addr_insert(int id) {
+    int low, high;
+    addr_split(addr_root, (uintptr_t) addr_blocks[id].payload, id, &low, &high);
+    addr_left[id] = addr_right[id] = -1;
+    addr_root = addr_merge(addr_merge(low, id), high);
+}
+
+static void addr_remove(int id) {
+    int low, high, rest;
+    addr_split(addr_root, (uintptr_t) addr_blocks[id].payload, id, &low, &high);
+    addr_split(high, (uintptr_t) addr_blocks[id].payload, id + 1, &high, &rest);
+    addr_root = addr_merge(low, rest);
+}
+
+/*
+ * check_neighbours - Checks the live blocks right before and after the
+ * payload of size bytes at addr, which belongs to block id and is not in the
+ * treap, still hold their ids, and if overlap is set that neither overlaps
+ * the payload.
+ */
+static int check_neighbours(size_t curr_op, void *addr, size_t size, int id, bool overlap) {
+    int neighbours[2] = {-1, -1};
+    for (int node = addr_root; node >= 0;) {
+        if (addr_less(node, (uintptr_t) addr, id)) {
+            neighbours[0] = node;
+            node = addr_right[node];
+        } else {
+            neighbours[1] = node;
+            node = addr_left[node];
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (neighbours[i] < 0) {
+            continue;
+        }
+        allocated_block_t *block = &addr_blocks[neighbours[i]];
+        if (check_id(block->payload, block->block_size, block->content_val) == -1) {
+            sprintf(msg, "umalloc corrupted block id %d.", neighbours[i]);
+            malloc_error(curr_op, msg);
+            return -1;
+        }
+        char *low = (i == 0) ? block->payload : addr;
+        char *high = (i == 0) ? addr : block->payload;
+        if (overlap && low + ((i == 0) ? block->block_size : size) > high) {
+            sprintf(msg, "umalloc returned a payload overlapping block id %d.", neighbours[i]);
+            malloc_error(curr_op, msg);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 /* 
  * check_correctness - Checks if every block that is mark allocated has the 
  * correct id written out. If this fails, means that an allocated payload
@@ -84,14 +246,23 @@ static int check_correctness(trace_t *trace, size_t curr_op) {
 
 size_t curr_bytes_in_use;
 size_t max_bytes_in_use;
+size_t max_bytes_held;      /* sampled after every op, for a backend without peak */
+
+/*
+ * peak_held - the most bytes the backend held from the system at once.
+ */
+static size_t peak_held(void) {
+    return (backend->peak != NULL) ? backend->peak() : max_bytes_held;
+}
 
 /* 
  * UTILIZATION_SCORE - the utilization score represents how well the umalloc
  * package uses the bytes requested from sbrk. For example, if 100 bytes are
  * requested from sbrk, and the user requested 80 bytes, there will be a 
- * utilization score of 80%.
+ * utilization score of 80%. Mapped memory counts while it is mapped, and
+ * the peak is the most ever held at once, sbrk_bytes for umalloc.
  */
-#define UTILIZATION_SCORE 100.0 * max_bytes_in_use / sbrk_bytes
+#define UTILIZATION_SCORE 100.0 * max_bytes_in_use / peak_held()
 
 /* 
  * run_trace_line - Runs a single line in the trace. Checking if all the 
@@ -116,7 +287,7 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
             printf("line %ld: umalloc: id %d, Allocating %d bytes\n", LINENUM(curr_op), op.index, op.size);
         }
 
-        trace->blocks[op.index].payload = umalloc(op.size);
+        trace->blocks[op.index].payload = backend->malloc(op.size);
         curr_bytes_in_use += op.size;
         if ( trace->blocks[op.index].payload == NULL) {
             malloc_error(curr_op, "umalloc failed.");
@@ -128,28 +299,97 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
             return -1;
         }
 
-        if(check_malloc_output(trace->blocks[op.index].payload, trace->blocks[op.index].block_size) == -1) {
+        if (backend->native &&
+            check_malloc_output(trace->blocks[op.index].payload, trace->blocks[op.index].block_size) == -1) {
             printf("line %ld: umalloc allocated a block out of bounds.\n", LINENUM(curr_op));
             return -1;
         }
 
         copy_id((size_t*) trace->blocks[op.index].payload, trace->blocks[op.index].block_size, curr_op);
+        if (incremental) {
+            if (check_neighbours(curr_op, trace->blocks[op.index].payload, op.size, op.index, true) == -1) {
+                return -1;
+            }
+            addr_insert(op.index);
+        }
+    } else if (op.type == REALLOC) {
+        allocated_block_t *block = &trace->blocks[op.index];
+        size_t old_size = block->is_allocated ? block->block_size : 0;
+        size_t kept_size = (old_size < op.size) ? old_size : op.size;
+
+        if (verbose) {
+            printf("line %ld: urealloc: id %d, Resizing %zu to %d bytes\n", LINENUM(curr_op), op.index, old_size, op.size);
+        }
+
+        void *payload = backend->realloc(block->is_allocated ? block->payload : NULL, op.size);
+        if (payload == NULL) {
+            malloc_error(curr_op, "urealloc failed.");
+            return -1;
+        }
+
+        if (((size_t)payload) % ALIGNMENT != 0) {
+            malloc_error(curr_op, "urealloc returned an unaligned payload.");
+            return -1;
+        }
+
+        if (backend->native && check_malloc_output(payload, op.size) == -1) {
+            printf("line %ld: urealloc allocated a block out of bounds.\n", LINENUM(curr_op));
+            return -1;
+        }
+
+        if (check_id(payload, kept_size, block->content_val) == -1) {
+            malloc_error(curr_op, "urealloc did not preserve the payload.");
+            return -1;
+        }
+
+        curr_bytes_in_use += op.size - old_size;
+        if (incremental && block->is_allocated) {
+            addr_remove(op.index);
+            if (check_neighbours(curr_op, block->payload, 0, op.index, false) == -1) {
+                return -1;
+            }
+        }
+        block->payload = payload;
+        block->block_size = op.size;
+        block->content_val = curr_op;
+        block->is_allocated = true;
+        copy_id((size_t*) payload, op.size, curr_op);
+        if (incremental) {
+            if (check_neighbours(curr_op, payload, op.size, op.index, true) == -1) {
+                return -1;
+            }
+            addr_insert(op.index);
+        }
     } else {
+        bool was_allocated = trace->blocks[op.index].is_allocated;
         trace->blocks[op.index].is_allocated = false;
 
         if (verbose) {
             printf("line %ld: ufree: id %d\n", LINENUM(curr_op), op.index);
         }
 
-        ufree(trace->blocks[op.index].payload);
+        backend->free(trace->blocks[op.index].payload);
         curr_bytes_in_use -= trace->blocks[op.index].block_size;
+        if (incremental && was_allocated) {
+            addr_remove(op.index);
+            if (check_neighbours(curr_op, trace->blocks[op.index].payload, 0, op.index, false) == -1) {
+                return -1;
+            }
+        }
     }
 
     if (curr_bytes_in_use > max_bytes_in_use) {
         max_bytes_in_use = curr_bytes_in_use;
     }
+    if (backend->peak == NULL && backend->held() > max_bytes_held) {
+        max_bytes_held = backend->held();
+    }
 
-    if (run_check_heap) {
+    // incremental checking leaves the full checks for every sweep_interval
+    // ops, and the last op
+    bool sweep = !incremental || curr_op == trace->num_ops - 1 ||
+                 (sweep_interval != 0 && (curr_op + 1) % sweep_interval == 0);
+    if (run_check_heap && sweep) {
         if (check_heap() != 0) {
             malloc_error(curr_op, "check heap failed.");
             return -1;
@@ -158,7 +398,7 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
         }
     }
 
-    if (check_correctness(trace, curr_op) == -1) {
+    if (sweep && check_correctness(trace, curr_op) == -1) {
         printf("line %ld failed the correctness check.\n", LINENUM(curr_op));
         return -1;
     }
@@ -170,6 +410,29 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
   return 0;
 }
 
+/* 
+ * report_trim - Gives every free byte back with utrim and reports how much of
+ * the peak footprint is still held, and how much of it is still in memory,
+ * which also drops for the pages utrim releases with madvise. The heap is
+ * checked again if requested. Other backends have no utrim, so only their
+ * peak is reported.
+ */
+static void report_trim(int run_check_heap) {
+    if (!backend->native) {
+        printf("Peak bytes held: %zu\n", peak_held());
+        return;
+    }
+    size_t before = held_bytes;
+    size_t resident_before = resident_bytes();
+    utrim(0);
+    printf("Bytes held after utrim: %zu (was %zu, peak %zu)\n", held_bytes, before, sbrk_bytes);
+    printf("Bytes resident after utrim: %zu (was %zu)\n", resident_bytes(), resident_before);
+    if (run_check_heap && check_heap() != 0) {
+        printf("check heap failed after utrim.\n");
+        exit(1);
+    }
+}
+
 /* 
  * auto_run_trace - Starting from curr_op, runs the trace to completetion. 
  * Printing the utlilization and running check_heap if requested. 
@@ -183,15 +446,19 @@ static int auto_run_trace(trace_t *trace, int utilization, int run_check_heap, s
 
     for(;curr_op < trace->num_ops; curr_op++) {
         if (run_trace_line(trace, curr_op, utilization, run_check_heap) == -1) {
-            printf("umalloc package failed.\n");
+            printf("%s package failed.\n", backend->name);
             exit(1);
         }
     }
 
-    printf("umalloc package passed correctness check.\n");
+    printf("%s package passed correctness check.\n", backend->name);
 
+    if (print_stats) {
+        ustats_print(stdout);
+    }
     if (utilization) {
         printf("Final Utilization percentage: %.2f\n", UTILIZATION_SCORE);
+        report_trim(run_check_heap);
     }
     return curr_op;
 }
@@ -205,6 +472,7 @@ void help() {
     printf("run n            -  execute trace for n ops\n");
     printf("check            -  run the heap_check                \n");
     printf("util             -  display current heap utilization   \n");
+    printf("info             -  display the allocator statistics   \n");
     printf("help             -  display this help menu            \n");
     printf("quit             -  exit the program                  \n\n");
 }
@@ -236,6 +504,10 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
     
     case 'C':
     case 'c':
+        if (!backend->native) {
+            printf("Only umalloc has a check_heap.\n");
+            break;
+        }
         printf("Running check_heap.\n");
         ret = check_heap();
         if (ret != 0)
@@ -252,6 +524,15 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
         printf("Bye.\n");
         exit(0);
 
+    case 'I':
+    case 'i':
+        if (!backend->native) {
+            printf("Only umalloc keeps statistics.\n");
+            break;
+        }
+        ustats_print(stdout);
+        break;
+
     case 'U':
     case 'u':
         printf("Current Utilization percentage: %.2f\n", UTILIZATION_SCORE);
@@ -271,18 +552,22 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
 
         for(int op = 0; op < ops_to_run; op++) {
             if (run_trace_line(trace, curr_op, utilization, run_check_heap) == -1) {
-                printf("umalloc package failed.\n");
+                printf("%s package failed.\n", backend->name);
                 exit(1);
             }
             curr_op++;
             if (curr_op == trace->num_ops) {
-                printf("umalloc package passed correctness check.\n");
+                printf("%s package passed correctness check.\n", backend->name);
+                if (print_stats) {
+                    ustats_print(stdout);
+                }
                 break;
             }
         }
 
         if (utilization && curr_op >= trace->num_ops) {
             printf("Final Utilization percentage: %.2f\n", UTILIZATION_SCORE);
+            report_trim(run_check_heap);
         }
 
         break;
@@ -299,12 +584,13 @@ int main(int argc, char **argv)
 {
 
   char c;
+  char *backend_name = "umalloc";
   int autorun = 0, run_check_heap = 0, display_utilization = 0;
 
   /* 
     * Read and interpret the command line arguments 
     */
-  while ((c = getopt(argc, argv, "rvhcu")) != EOF) {
+  while ((c = getopt(argc, argv, "rvhcusi:b:")) != EOF) {
     switch (c) {
     case 'r': /* Generate summary info for the autograder */
         autorun = 1;
@@ -321,6 +607,16 @@ int main(int argc, char **argv)
     case 'u':
         display_utilization = 1;
         break;
+    case 's':
+        print_stats = 1;
+        break;
+    case 'i':
+        incremental = 1;
+        sweep_interval = strtoul(optarg, NULL, 10);
+        break;
+    case 'b':
+        backend_name = optarg;
+        break;
     default:
         usage();
         exit(1);
@@ -334,6 +630,15 @@ int main(int argc, char **argv)
         appl_error("Missing file parameters.");
     }
 
+    backend = find_backend(backend_name);
+    if (backend == NULL) {
+        usage();
+        appl_error("Unknown backend.");
+    }
+    if (!backend->native && (run_check_heap || print_stats)) {
+        appl_error("Only the umalloc backend has a check_heap and statistics.");
+    }
+
     if (verbose) {
         if (autorun) {
             printf("Auto Run Enabled.\n");
@@ -346,18 +651,26 @@ int main(int argc, char **argv)
         if (run_check_heap) {
            printf("Running Check Heap After Each Op.\n");
         }
+
+        if (incremental) {
+            printf("Checking Incrementally, Full Check Every %zu Ops.\n", sweep_interval);
+        }
     }
 
     printf("Welcome to the MM lab runner\n\n");
     printf("Author: %s\n", author);
 
     trace_t *trace = read_trace(file, verbose);
-    if (uinit() == -1) {
+    if (incremental) {
+        addr_init(trace);
+    }
+    if (backend->init() == -1) {
         malloc_error(-3, "uinit failed.");
         exit(1);
     }
     curr_bytes_in_use = 0;
     max_bytes_in_use = 0;
+    max_bytes_held = 0;
     if (autorun) {
         auto_run_trace(trace, display_utilization, run_check_heap, 0);
     } else {
@@ -9,6 +9,9 @@
 
 #include "support.h"
 #include "err_handler.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
@@ -34,7 +37,57 @@ void malloc_error(int opnum, char *msg)
 }
 
 /*
- * read_trace - read a trace file and store it in memory
+ * map_trace - maps a binary trace file and uses its records in place. The
+ * records are checked once, so a bad file fails here and not mid replay.
+ */
+static void map_trace(trace_t *trace, char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        sprintf(msg, "Could not open %s in read_trace", filename);
+        appl_error(msg);
+    }
+    if (st.st_size < sizeof(trace_header_t)) {
+        sprintf(msg, "Binary trace %s is truncated", filename);
+        appl_error(msg);
+    }
+    trace->map_length = st.st_size;
+    trace->map = mmap(NULL, trace->map_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace->map == MAP_FAILED) {
+        sprintf(msg, "Could not map %s in read_trace", filename);
+        appl_error(msg);
+    }
+    madvise(trace->map, trace->map_length, MADV_WILLNEED);
+
+    trace_header_t *header = (trace_header_t *) trace->map;
+    if (header->record_size != sizeof(traceop_t)) {
+        sprintf(msg, "Binary trace %s has %u byte records, expected %zu", filename,
+                header->record_size, sizeof(traceop_t));
+        appl_error(msg);
+    }
+    trace->num_ids = header->num_ids;
+    trace->num_ops = header->num_ops;
+    if (trace->num_ids <= 0 || trace->num_ops < 0 ||
+        trace->map_length != sizeof(trace_header_t) + (size_t) trace->num_ops * sizeof(traceop_t)) {
+        sprintf(msg, "Binary trace %s does not match its header", filename);
+        appl_error(msg);
+    }
+    trace->ops = (traceop_t *) (header + 1);
+
+    for (int op_index = 0; op_index < trace->num_ops; op_index++) {
+        traceop_t op = trace->ops[op_index];
+        if (op.type > REALLOC || op.index < 0 || op.index >= trace->num_ids || op.size < 0) {
+            sprintf(msg, "Bogus record %d in tracefile %s", op_index, filename);
+            appl_error(msg);
+        }
+    }
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. Binary traces,
+ * recognised by TRACE_MAGIC, are mapped instead of parsed.
  */
 trace_t *read_trace(char *filename, int verbose)
 {
@@ -49,6 +102,8 @@ trace_t *read_trace(char *filename, int verbose)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         appl_error("malloc 1 failed in read_trace");
+    trace->map = NULL;
+    trace->map_length = 0;
 
     /* Read the trace file header */
     if ((tracefile = fopen(filename, "r")) == NULL) {
@@ -56,6 +111,18 @@ trace_t *read_trace(char *filename, int verbose)
         appl_error(msg);
     }
 
+    char magic[TRACE_MAGIC_LEN];
+    if (fread(magic, 1, TRACE_MAGIC_LEN, tracefile) == TRACE_MAGIC_LEN &&
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+        fclose(tracefile);
+        map_trace(trace, filename);
+        trace->blocks = (allocated_block_t *)calloc(trace->num_ids, sizeof(allocated_block_t));
+        if (trace->blocks == NULL)
+            appl_error("Failed to allocate block array");
+        return trace;
+    }
+    rewind(tracefile);
+
     err = fscanf(tracefile, "%d", &(trace->num_ids)); 
     if (err == EOF) {
         appl_error("fscanf failed to find num ids.");
@@ -94,6 +161,16 @@ trace_t *read_trace(char *filename, int verbose)
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
+        case 'r':
+            err = fscanf(tracefile, "%u %u", &index, &size);
+            if (err == EOF) {
+                appl_error("fscanf failed to find index and size.");
+            }
+            trace->ops[op_index].type = REALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
         case 'f':
             err = fscanf(tracefile, "%ud", &index);
             if (err == EOF) {
@@ -116,13 +193,43 @@ trace_t *read_trace(char *filename, int verbose)
     return trace;
 }
 
+/*
+ * write_trace_binary - write a trace out in the binary format that
+ *                      read_trace() maps in place.
+ */
+void write_trace_binary(trace_t *trace, char *filename)
+{
+    FILE *tracefile;
+    trace_header_t header;
+
+    if ((tracefile = fopen(filename, "w")) == NULL) {
+        sprintf(msg, "Could not open %s in write_trace_binary", filename);
+        appl_error(msg);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.record_size = sizeof(traceop_t);
+    header.num_ids = trace->num_ids;
+    header.num_ops = trace->num_ops;
+    if (fwrite(&header, sizeof(header), 1, tracefile) != 1 ||
+        fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, tracefile) != trace->num_ops ||
+        fclose(tracefile) != 0) {
+        sprintf(msg, "Failed to write %s", filename);
+        appl_error(msg);
+    }
+}
+
 /*
  * free_trace - Free the trace record and the two arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the two arrays... */
+    if (trace->map != NULL)
+        munmap(trace->map, trace->map_length);  /* ops live in the mapping */
+    else
+        free(trace->ops);     /* free the two arrays... */
     free(trace->blocks);      
     free(trace);              /* and the trace record itself... */
 }
\ No newline at end of file
@@ -33,9 +33,9 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc request */
+    int size;                         /* byte size of alloc or realloc request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -44,9 +44,27 @@ typedef struct {
     int num_ops;         /* number of distinct requests */
     traceop_t *ops;      /* array of requests */
     allocated_block_t *blocks; /* array of blocks returned by umalloc */
+    void *map;           /* mapping of a binary trace that ops points into, or NULL */
+    size_t map_length;
 } trace_t;
 
+/*
+ * Binary traces start with this header, followed directly by num_ops packed
+ * traceop_t records, so a mapped file can be replayed in place.
+ */
+#define TRACE_MAGIC "UMTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+typedef struct {
+    char magic[TRACE_MAGIC_LEN]; /* TRACE_MAGIC, not NUL terminated */
+    uint32_t record_size;        /* sizeof(traceop_t) of the writer */
+    int32_t num_ids;
+    int32_t num_ops;
+    uint32_t unused;             /* keeps the records 8 byte aligned */
+} trace_header_t;
+
 void appl_error(char *msg);
 void malloc_error(int opnum, char *msg);
 trace_t *read_trace(char *filename, int verbose);
+void write_trace_binary(trace_t *trace, char *filename);
 void free_trace(trace_t *trace);
\ No newline at end of file
@@ -0,0 +1,33 @@
+#!/usr/bin/perl
+
+$out_filename = "realloc.rep";
+$blk_size = 512;
+$grow_size = 128;
+$small_size = 128;
+$num_iters = 2400;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+# block 0 keeps growing, a small block is allocated and the previous one
+# freed around every realloc
+$num_blocks = $num_iters + 1;
+$num_ops = 3*$num_iters;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+
+print OUTFILE "a 0 $blk_size\n";
+print OUTFILE "a 1 $small_size\n";
+for ($i = 1;  $i < $num_iters; $i += 1) {
+    $size = $blk_size + $i*$grow_size;
+    $seq = $i + 1;
+    print OUTFILE "r 0 $size\n";
+    print OUTFILE "a $seq $small_size\n";
+    print OUTFILE "f $i\n";
+}
+$size = $blk_size + $num_iters*$grow_size;
+print OUTFILE "r 0 $size\n";
+
+close OUTFILE;
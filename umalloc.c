@@ -1,6 +1,16 @@
+#define _GNU_SOURCE /* for mremap */
 #include "umalloc.h"
 #include "csbrk.h"
 #include "ansicolors.h"
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#ifdef UMALLOC_THREADS
+#include <pthread.h>
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 const char author[] = ANSI_BOLD ANSI_COLOR_RED "Christopher Carrasco cc66496" ANSI_RESET;
 
@@ -9,12 +19,69 @@ const char author[] = ANSI_BOLD ANSI_COLOR_RED "Christopher Carrasco cc66496" AN
  * struct, they can be adjusted as necessary.
  */
 
-// A sample pointer to the start of the free list.
-memory_block_t *free_head;
-// keeps count of the number of free blocks that should be in the free list
+// heads of the segregated free lists, indexed by [first level][second level]
+memory_block_t *seg_lists[FL_INDEX_COUNT][SL_INDEX_COUNT];
+// bit fl is set when some list in first level fl is non-empty
+unsigned int fl_bitmap;
+// bit sl of sl_bitmap[fl] is set when seg_lists[fl][sl] is non-empty
+unsigned int sl_bitmap[FL_INDEX_COUNT];
+// keeps count of the number of free blocks that should be in the free lists
 unsigned long num_free_blocks;
+// packed sizes of some of the blocks in each list, for fit searches
+fit_index_t fit_index[FL_INDEX_COUNT][SL_INDEX_COUNT];
 // the size of the heap minus headers
 static size_t heap_size = 0;
+// the allocated, zero sized block that ends the most recent heap chunk
+static memory_block_t *last_epilogue = NULL;
+// heap memory from here up to last_epilogue has never been handed out, so it
+// reads as zeros apart from the header, first word and footer of a free block
+static char *clean_start = NULL;
+// slab runs of each size class with at least one free object
+slab_run_t *slab_partial[SLAB_CLASSES];
+// empty slab pages that any size class may reuse
+slab_run_t *slab_free_pages;
+// one bit per page from slab_map_base up, set for the pages that are slab runs;
+// mapped once with MAP_NORESERVE, so only the part covering the heap is touched
+#define SLAB_MAP_PAGES (1UL << 24) /* the first 64GiB from the start of the heap */
+static uint64_t *slab_map;
+static char *slab_map_base;
+// words of slab_map that may have bits set
+static size_t slab_map_used;
+// empty slab pages utrim gave back, which read as zeros and so cannot link
+// themselves; the table is mapped apart from the heap, and not through cmmap
+// so it never counts as held, and grows by doubling
+static slab_run_t **slab_released;
+static size_t num_slab_released;
+static size_t slab_released_capacity;
+// every block mapped outside the heap
+large_block_t *mapped_blocks;
+// blocks taken off the heap, and their count at the last growth, for the
+// adaptive growth policy
+static unsigned long heap_allocs;
+static unsigned long last_growth;
+// the least the adaptive policy grows the heap by
+static size_t growth_step = GROWTH_GRANULE;
+
+// the heap grows through csbrk, or through chsbrk's huge page region when
+// built with UMALLOC_HUGE
+#ifdef UMALLOC_HUGE
+#define heap_sbrk chsbrk
+#define heap_break() chsbrk(0)
+#else
+#define heap_sbrk csbrk
+#define heap_break() sbrk(0)
+#endif
+
+#ifdef UMALLOC_STATS
+// the counted part of ustats, updated atomically since the thread safe build
+// counts allocs and frees outside the heap lock
+static ustats_t counted;
+#define STAT_ADD(field, n) __atomic_fetch_add(&counted.field, (n), __ATOMIC_RELAXED)
+#define STAT_SUB(field, n) __atomic_fetch_sub(&counted.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(field, n) ((void) 0)
+#define STAT_SUB(field, n) ((void) 0)
+#endif
 
 /*
  * is_allocated - returns true if a block is marked as allocated.
@@ -56,6 +123,23 @@ memory_block_t *get_next(memory_block_t *block) {
     return block->next;
 }
 
+/*
+ * get_prev - gets the previous block in the free list. Only valid for free
+ * blocks, since the link is kept in the payload.
+ */
+memory_block_t *get_prev(memory_block_t *block) {
+    assert(block != NULL);
+    return *(memory_block_t **) get_payload(block);
+}
+
+/*
+ * set_prev - sets the previous block in the free list.
+ */
+void set_prev(memory_block_t *block, memory_block_t *prev) {
+    assert(block != NULL);
+    *(memory_block_t **) get_payload(block) = prev;
+}
+
 /*
  * put_block - puts a block struct into memory at the specified address.
  * Initializes the size and allocated fields, along with NUlling out the next 
@@ -85,53 +169,403 @@ memory_block_t *get_block(void *payload) {
     return ((memory_block_t *)payload) - 1;
 }
 
+/*
+ * is_prev_allocated - returns true if the block before this one in memory is
+ * allocated. Blocks at the start of a heap chunk count their missing neighbour
+ * as allocated.
+ */
+bool is_prev_allocated(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & PREV_ALLOC;
+}
+
+/*
+ * set_prev_allocated - records whether the block before this one in memory is
+ * allocated.
+ */
+void set_prev_allocated(memory_block_t *block, bool prev_alloc) {
+    assert(block != NULL);
+    if (prev_alloc) {
+        block->block_size_alloc |= PREV_ALLOC;
+    } else {
+        block->block_size_alloc &= ~PREV_ALLOC;
+    }
+}
+
+/*
+ * is_mapped - returns true if a block was mapped on its own outside the heap.
+ */
+bool is_mapped(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & MAPPED;
+}
+
+/*
+ * is_indexed - returns true if a free block is in its list's fit index.
+ */
+bool is_indexed(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & INDEXED;
+}
+
+/*
+ * put_footer - copies the size of a free block into the last word of its
+ * payload.
+ */
+void put_footer(memory_block_t *block) {
+    assert(block != NULL);
+    assert(get_size(block) >= sizeof(size_t));
+    *(size_t *) ((char *) get_payload(block) + get_size(block) - sizeof(size_t)) = get_size(block);
+}
+
+/*
+ * get_next_block - gets the block directly after this one in memory. Every
+ * heap chunk ends in an epilogue block, so this is always a valid header.
+ */
+memory_block_t *get_next_block(memory_block_t *block) {
+    assert(block != NULL);
+    return (memory_block_t *) ((char *) get_payload(block) + get_size(block));
+}
+
+/*
+ * get_prev_block - gets the block directly before this one in memory, by
+ * reading its footer. Only valid if that block is free.
+ */
+memory_block_t *get_prev_block(memory_block_t *block) {
+    assert(block != NULL);
+    assert(!is_prev_allocated(block));
+    size_t prev_size = *((size_t *) block - 1);
+    return (memory_block_t *) ((char *) block - prev_size - ALIGNMENT);
+}
+
+/*
+ * mapping_insert - computes the segregated list that a free block of the given
+ * size belongs in.
+ */
+void mapping_insert(size_t size, int *fl, int *sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        // small sizes get one list per ALIGNMENT step
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        int msb = 63 - __builtin_clzl(size);
+        *sl = (size >> (msb - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = msb - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+/*
+ * mapping_search - computes the first segregated list whose blocks are all
+ * large enough for a request of the given size. The size is rounded up to the
+ * start of the next list so the head of any list at or above it fits.
+ */
+void mapping_search(size_t size, int *fl, int *sl) {
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += (1UL << (63 - __builtin_clzl(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+/*
+ * index_add - puts a free block in a free slot of a fit index.
+ */
+static void index_add(fit_index_t *index, memory_block_t *block) {
+    index->sizes[index->count] = get_size(block) / ALIGNMENT;
+    index->blocks[index->count] = block;
+    index->count++;
+    block->block_size_alloc |= INDEXED;
+}
+
+/*
+ * index_remove - takes a block out of its fit index, moving the last slot into
+ * its place. Recently inserted blocks are the likeliest to go, so the search
+ * starts from the last slot.
+ */
+static void index_remove(fit_index_t *index, memory_block_t *block) {
+    int slot = index->count - 1;
+    while (index->blocks[slot] != block) {
+        slot--;
+        assert(slot >= 0);
+    }
+    index->count--;
+    index->sizes[slot] = index->sizes[index->count];
+    index->blocks[slot] = index->blocks[index->count];
+    index->sizes[index->count] = 0;
+    block->block_size_alloc &= ~INDEXED;
+}
+
+/*
+ * index_scan - returns the first slot of a fit index holding a block of at
+ * least size bytes, or -1. All slots are compared at once, unused ones hold 0.
+ */
+static int index_scan(fit_index_t *index, size_t size) {
+    int32_t below = size / ALIGNMENT - 1;
+    unsigned int fits = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32(below);
+    for (int slot = 0; slot < FIT_INDEX_SLOTS; slot += 8) {
+        __m256i sizes = _mm256_loadu_si256((__m256i *) &index->sizes[slot]);
+        __m256i greater = _mm256_cmpgt_epi32(sizes, key);
+        fits |= (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(greater)) << slot;
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(below);
+    for (int slot = 0; slot < FIT_INDEX_SLOTS; slot += 4) {
+        __m128i sizes = _mm_loadu_si128((__m128i *) &index->sizes[slot]);
+        __m128i greater = _mm_cmpgt_epi32(sizes, key);
+        fits |= (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(greater)) << slot;
+    }
+#else
+    for (int slot = 0; slot < FIT_INDEX_SLOTS; slot++) {
+        fits |= (unsigned int) (index->sizes[slot] > below) << slot;
+    }
+#endif
+    return (fits == 0) ? -1 : __builtin_ctz(fits);
+}
+
+/*
+ * insert_free_block - links a free block into its segregated list. By default
+ * the block is pushed onto the head of the list; building with
+ * -DADDRESS_ORDERED keeps every list in increasing address order instead.
+ */
+void insert_free_block(memory_block_t *block) {
+    assert(block != NULL);
+    assert(!is_allocated(block));
+    int fl, sl;
+    mapping_insert(get_size(block), &fl, &sl);
+    assert(fl < FL_INDEX_COUNT);
+
+    memory_block_t *prev = NULL;
+    memory_block_t *cur = seg_lists[fl][sl];
+#ifdef ADDRESS_ORDERED
+    while (cur != NULL && cur < block) {
+        prev = cur;
+        cur = cur->next;
+    }
+#endif
+    block->next = cur;
+    set_prev(block, prev);
+    if (cur != NULL) {
+        set_prev(cur, block);
+    }
+    if (prev == NULL) {
+        seg_lists[fl][sl] = block;
+    } else {
+        prev->next = block;
+    }
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+    num_free_blocks++;
+
+    fit_index_t *index = &fit_index[fl][sl];
+    if (index->count < FIT_INDEX_SLOTS) {
+        index_add(index, block);
+    } else {
+        index->unindexed++;
+    }
+}
+
+/*
+ * remove_free_block - unlinks a free block from its segregated list.
+ */
+void remove_free_block(memory_block_t *block) {
+    assert(block != NULL);
+    int fl, sl;
+    mapping_insert(get_size(block), &fl, &sl);
+
+    memory_block_t *prev = get_prev(block);
+    memory_block_t *next = block->next;
+    if (prev == NULL) {
+        assert(seg_lists[fl][sl] == block);
+        seg_lists[fl][sl] = next;
+    } else {
+        prev->next = next;
+    }
+    if (next != NULL) {
+        set_prev(next, prev);
+    }
+    block->next = NULL;
+    if (is_indexed(block)) {
+        index_remove(&fit_index[fl][sl], block);
+    } else {
+        fit_index[fl][sl].unindexed--;
+    }
+    // clear the bitmaps once the list runs dry
+    if (seg_lists[fl][sl] == NULL) {
+        sl_bitmap[fl] &= ~(1U << sl);
+        if (sl_bitmap[fl] == 0) {
+            fl_bitmap &= ~(1U << fl);
+        }
+    }
+    num_free_blocks--;
+}
+
 /*
  * The following are helper functions that can be implemented to assist in your
  * design, but they are not required. 
  */
 
 /*
- * find - finds a free block that can satisfy the umalloc request.
+ * round_growth - rounds the payload bytes of an extend up to a multiple of
+ * GROWTH_GRANULE.
  */
-memory_block_t *find(size_t size) {
-    memory_block_t *result = free_head;
-    assert(free_head != NULL);
+static size_t round_growth(size_t size) {
+    size = (size + GROWTH_GRANULE - 1) / GROWTH_GRANULE * GROWTH_GRANULE;
+    return (size > 0) ? size : GROWTH_GRANULE;
+}
+
+/*
+ * growth_size - the payload bytes to extend the heap by when it is shortfall
+ * bytes short, padded as GROWTH_POLICY says.
+ */
+static size_t growth_size(size_t shortfall) {
+    size_t size = shortfall;
+#if GROWTH_POLICY == GROWTH_GEOMETRIC
+    size = (heap_size > size) ? heap_size : size;
+#elif GROWTH_POLICY == GROWTH_ADAPTIVE
+    if (heap_allocs - last_growth < GROWTH_WINDOW) {
+        growth_step = (growth_step * 2 <= PAGESIZE * ALIGNMENT) ? growth_step * 2 : growth_step;
+    } else if (growth_step / 2 >= GROWTH_GRANULE) {
+        growth_step /= 2;
+    }
+    last_growth = heap_allocs;
+    size = (growth_step > size) ? growth_step : size;
+#endif
+    return round_growth(size);
+}
 
-    // first fit
-    while (result->next != NULL) {
+/*
+ * grow_heap - extends the heap until there is a free block of at least size
+ * bytes, and returns it coalesced and in its list. When the break has not
+ * moved since the last chunk, the new memory merges with the free block at
+ * the top of the heap, the wilderness, and with the old epilogue, so only the
+ * rest is asked for. Returns NULL if csbrk fails.
+ */
+static memory_block_t *grow_heap(size_t size) {
+    while (true) {
+        size_t have = 0;
+        if (last_epilogue != NULL && (void *) (last_epilogue + 1) == heap_break()) {
+            // the old epilogue becomes the header of the new memory
+            have = ALIGNMENT;
+            if (!is_prev_allocated(last_epilogue)) {
+                have += get_size(get_prev_block(last_epilogue)) + ALIGNMENT;
+            }
+        }
+        memory_block_t *more = extend(growth_size((size > have) ? size - have : 0));
+        if (more == NULL) {
+            return NULL;
+        }
+        memory_block_t *result = coalesce(more);
         if (get_size(result) >= size) {
             return result;
         }
-        assert(result != result->next);
-        result = result->next;
     }
-    // check last free block
-    if (get_size(result) >= size) {
-        return result;
+}
+
+/*
+ * count_visits - files the number of free blocks one find looked at.
+ */
+static inline void count_visits(size_t visits) {
+#ifdef UMALLOC_STATS
+    STAT_ADD(find_visits, visits);
+    if (visits > counted.find_max_visits) {
+        counted.find_max_visits = visits;
     }
-    // need more room! set last free block next to extend result
-    result->next = extend(heap_size + ALIGNMENT);
-    result = result->next;
-    while (get_size(result) < size) {
-        result->next = extend(heap_size + ALIGNMENT);
-        coalesce(result);
-    }    
-    num_free_blocks++;
+#endif
+}
 
-    return result;
+/*
+ * find - finds a free block that can satisfy the umalloc request. The block is
+ * left in its segregated list. Both bitmap lookups are a single find-first-set,
+ * so the cost does not depend on the number of free blocks.
+ */
+memory_block_t *find(size_t size) {
+    int fl, sl;
+    STAT_ADD(finds, 1);
+    mapping_search(size, &fl, &sl);
+    if (fl < FL_INDEX_COUNT) {
+        // non-empty lists at or above sl in the same first level
+        unsigned int sl_map = sl_bitmap[fl] & (~0U << sl);
+        if (sl_map == 0) {
+            // otherwise any list in the next non-empty first level
+            unsigned int fl_map = fl_bitmap & (~0U << (fl + 1));
+            if (fl_map != 0) {
+                fl = __builtin_ctz(fl_map);
+                sl_map = sl_bitmap[fl];
+            }
+        }
+        if (sl_map != 0) {
+            count_visits(1);
+            return seg_lists[fl][__builtin_ctz(sl_map)];
+        }
+    }
+    // before growing the heap, first fit in the list the request itself maps
+    // to, which the rounded up search skips
+    mapping_insert(size, &fl, &sl);
+    if (fl < FL_INDEX_COUNT) {
+        fit_index_t *index = &fit_index[fl][sl];
+        int slot = index_scan(index, size);
+        size_t visits = index->count;
+        if (slot >= 0) {
+            count_visits(visits);
+            return index->blocks[slot];
+        }
+        // only blocks past the slots are left, pull them in on the way
+        for (memory_block_t *cur = seg_lists[fl][sl]; index->unindexed > 0 && cur != NULL; cur = cur->next) {
+            visits++;
+            if (is_indexed(cur)) {
+                continue;
+            }
+            if (get_size(cur) >= size) {
+                count_visits(visits);
+                return cur;
+            }
+            if (index->count < FIT_INDEX_SLOTS) {
+                index->unindexed--;
+                index_add(index, cur);
+            }
+        }
+        count_visits(visits);
+    }
+    // need more room!
+    return grow_heap(size);
 }
 
 /*
- * extend - extends the heap if more memory is required.
+ * extend - extends the heap if more memory is required. The new block is not
+ * put in any free list. Each chunk from csbrk ends in an epilogue block; when
+ * the new chunk directly follows the last one, the old epilogue becomes the
+ * header of the new block. Returns NULL, leaving the heap as it was, if csbrk
+ * fails.
  */
 memory_block_t *extend(size_t size) {
-    if (size > PAGESIZE * ALIGNMENT - ALIGNMENT) {
-        size = PAGESIZE * ALIGNMENT - ALIGNMENT;
+    if (size > PAGESIZE * ALIGNMENT - ALIGNMENT * 2) {
+        size = PAGESIZE * ALIGNMENT - ALIGNMENT * 2;
     }
     // creates new free block to represent new heap memory
-    memory_block_t *result = (memory_block_t *) csbrk(size + ALIGNMENT);
-    assert(result != NULL);
+    // csbrk fails with -1 like sbrk, and chsbrk with NULL once its region is full
+    memory_block_t *result = (memory_block_t *) heap_sbrk(size + ALIGNMENT * 2);
+    if (result == NULL || result == (void *) -1) {
+        return NULL;
+    }
+    STAT_ADD(extends, 1);
+    STAT_ADD(heap_bytes, size + ALIGNMENT * 2);
+    bool prev_alloc = true;
+    if (last_epilogue != NULL && result == last_epilogue + 1) {
+        // reuse the old epilogue as the header
+        prev_alloc = is_prev_allocated(last_epilogue);
+        result = last_epilogue;
+        size += ALIGNMENT;
+    } else {
+        // a new chunk is all fresh memory
+        clean_start = (char *) result;
+    }
     put_block(result, size, false);
+    set_prev_allocated(result, prev_alloc);
+    put_footer(result);
+    // the new epilogue, after a free block
+    last_epilogue = get_next_block(result);
+    put_block(last_epilogue, 0, true);
     // double heap_size until larger than PAGESIZE * ALGNMENT - ALIGNMENT
     heap_size += size;
     
@@ -139,174 +573,1402 @@ memory_block_t *extend(size_t size) {
 }
 
 /*
- * split - splits a given block in parts, one allocated, one free.
+ * split - splits a given free block in parts, one allocated, one free.
+ * size includes the header of the allocated part. Returns the allocated block.
  */
 memory_block_t *split(memory_block_t *block, size_t size) {
-    // put split allocated block in memory
     size_t free_size = get_size(block) - size;
-    block->block_size_alloc = (size - ALIGNMENT) | true;
+    bool prev_alloc = is_prev_allocated(block);
     // create new split free block by setting pointer to block address + size
     memory_block_t *new_free_block = (memory_block_t *) ((char *) block + size);
-    if (free_size % ALIGNMENT != 0) {
-        free_size -= free_size % ALIGNMENT;
-    }
     put_block(new_free_block, free_size, false);
+    set_prev_allocated(new_free_block, true);
+    put_footer(new_free_block);
     update_list(block, new_free_block);
+    STAT_ADD(splits, 1);
+    // put split allocated block in memory
+    put_block(block, size - ALIGNMENT, true);
+    set_prev_allocated(block, prev_alloc);
     assert(get_size(block) == size - ALIGNMENT);
-    assert(free_head->next == NULL || free_head < free_head->next);
     
-    return get_payload(block);
+    return block;
 }
 
 /**
- * remove the old_block from the free list and insert the new_free_block. 
+ * remove the old_block from the free lists and insert the new_free_block. 
  * 
- * @param old_block the split block to be allocated
+ * @param old_block the block being split, still sized as a free block
  * @param new_free_block the split free block
  */
 void update_list(memory_block_t *old_block, memory_block_t *new_free_block) {
-    assert(is_allocated(old_block));
+    assert(!is_allocated(old_block));
     assert(!is_allocated(new_free_block));
-    if (num_free_blocks == 1) {
-        free_head = new_free_block;
+    remove_free_block(old_block);
+    insert_free_block(new_free_block);
+}
+
+/*
+ * scrub_boundary - zeroes what is left of the footer before block, its header
+ * and its first payload word once block is merged into the free block before
+ * it, if they lie in the clean part of the heap.
+ */
+static void scrub_boundary(memory_block_t *block) {
+    char *start = (char *) block - sizeof(size_t);
+    char *end = (char *) get_payload(block) + sizeof(memory_block_t *);
+    if (end <= clean_start) {
         return;
     }
-    memory_block_t *prev = free_head;
-    memory_block_t *cur = free_head;
-    // search for old_block to remove
-    while (cur != NULL && cur != old_block) {
-        prev = cur;
-        cur = cur->next;
-    }
-    if (cur == free_head) {
-        free_head = new_free_block;
-        new_free_block->next = old_block->next;
-    } else {
-        prev->next = new_free_block;
-        new_free_block->next = cur->next;
+    if (start < clean_start) {
+        start = clean_start;
     }
+    memset(start, 0, end - start);
 }
 
 /*
- * coalesce - coalesces a free memory block with neighbors.
+ * coalesce - coalesces a free block that is not yet in any list with the free
+ * blocks directly before and after it in memory, then inserts the result into
+ * the segregated lists. Returns the coalesced block.
  */
-void coalesce(memory_block_t *block) {
+memory_block_t *coalesce(memory_block_t *block) {
     assert(block != NULL);
-    memory_block_t *prev = free_head;
-    memory_block_t *cur = free_head;
-    // find the previous block which may need coalescing
-    while (cur != NULL && cur != block) {
-        prev = cur;
-        cur = cur->next;
-    }
-    size_t prev_size = get_size(prev) + ALIGNMENT;
-    size_t cur_size = get_size(cur) + ALIGNMENT;
+    assert(!is_allocated(block));
+    size_t size = get_size(block);
+    memory_block_t *after = get_next_block(block);
 
     // a free block after block
-    if ((memory_block_t *) ((char *) cur + cur_size) == cur->next) {
-        cur_size = cur_size + get_size(cur->next);
-        if (cur_size % ALIGNMENT != 0) {
-            cur_size -= cur_size % ALIGNMENT;
-        }
-        cur->block_size_alloc = cur_size | false;
-        cur->next = cur->next->next;
-        num_free_blocks--;
+    if (!is_allocated(after)) {
+        remove_free_block(after);
+        size += get_size(after) + ALIGNMENT;
+        scrub_boundary(after);
+        STAT_ADD(coalesces, 1);
     }
     // a free block before block
-    if ((memory_block_t *) ((char *) prev + prev_size) == cur) {
-        prev_size = prev_size + get_size(cur);
-        if (prev_size % ALIGNMENT != 0) {
-            prev_size -= prev_size % ALIGNMENT;
-        }
-        prev->block_size_alloc = prev_size | false;
-        prev->next = cur->next;
-        num_free_blocks--;
+    if (!is_prev_allocated(block)) {
+        memory_block_t *before = get_prev_block(block);
+        remove_free_block(before);
+        size += get_size(before) + ALIGNMENT;
+        scrub_boundary(block);
+        block = before;
+        STAT_ADD(coalesces, 1);
     }
-}
+    // the block before a free block is always allocated
+    put_block(block, size, false);
+    set_prev_allocated(block, true);
+    put_footer(block);
+    set_prev_allocated(get_next_block(block), false);
+    insert_free_block(block);
 
+    return block;
+}
 
 
 /*
- * uinit - Used to initialize metadata required to manage the heap
- * along with allocating initial memory.
+ * claim_block - moves the clean part of the heap past a block that is being
+ * handed out.
  */
-int uinit() {
-    // put initial heap size to 8192B + hidden 16 for header
-    free_head = extend(PAGESIZE * 2);
-    num_free_blocks = 1;
-    // check for errors
-    if (free_head == NULL || get_size(free_head) != PAGESIZE * 2 || heap_size != PAGESIZE * 2) {
-        return -1;
+static void claim_block(memory_block_t *block) {
+    char *end = (char *) get_next_block(block);
+    if (end > clean_start) {
+        clean_start = end;
     }
-
-    return EXIT_SUCCESS;
 }
 
 /*
- * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * dirty_bytes - the number of bytes at the start of a newly allocated block's
+ * payload that may not be zero, given where the clean part of the heap began
+ * before it was allocated. The last word of a payload that reaches into the
+ * clean part may hold the footer of the free block it came from, so it is
+ * zeroed here.
  */
-void *umalloc(size_t size) {
-    // align
-    if (size % ALIGNMENT != 0) {
-        size += ALIGNMENT - (size % ALIGNMENT);
+static size_t dirty_bytes(memory_block_t *block, char *clean) {
+    char *payload = get_payload(block);
+    size_t size = get_size(block);
+    if (clean >= payload + size) {
+        return size;
     }
+    ((size_t *) (payload + size))[-1] = 0;
+    // the first word held the free list link
+    if (clean < payload + sizeof(memory_block_t *)) {
+        return sizeof(memory_block_t *);
+    }
+    return clean - payload;
+}
+
+/*
+ * alloc_block - takes a block with a payload of at least size bytes off the
+ * heap and marks it allocated. size must already be aligned. If dirty is not
+ * NULL, it is set to the number of bytes at the start of the payload that may
+ * not be zero; the rest of the payload reads as zeros. Returns NULL if the
+ * heap cannot grow.
+ */
+static memory_block_t *alloc_block(size_t size, size_t *dirty) {
     // find free block to put it
     memory_block_t *result = find(size);
+    if (result == NULL) {
+        return NULL;
+    }
+    heap_allocs++;
+    char *clean = clean_start;
 
-     // no need to split
+     // no need to split, hand out the whole block
     if (get_size(result) - size < ALIGNMENT * 2)  {
-        result->block_size_alloc = size | true;
-        // found block is only one left, extend heap
-        if (num_free_blocks == 1) {
-            free_head = extend(heap_size);
-            return get_payload(result);
-        }
-        memory_block_t *prev = free_head;
-        // find the free block before result to remove result
-        if (prev == result) {
-            free_head = prev->next;
-        } else {
-            while (prev->next != NULL && prev->next != result) {
-                prev = prev->next;
+        remove_free_block(result);
+        allocate(result);
+        set_prev_allocated(get_next_block(result), true);
+    } else {
+        // split the free block into an allocated and free block
+        split(result, size + ALIGNMENT);
+    }
+    claim_block(result);
+    if (dirty != NULL) {
+        *dirty = dirty_bytes(result, clean);
+    }
+
+    return result;
+}
+
+/*
+ * shrink_block - cuts an allocated block down to size bytes of payload,
+ * returning the tail to the heap if it is large enough to be a block.
+ */
+static void shrink_block(memory_block_t *block, size_t size) {
+    size_t old_size = get_size(block);
+    if (old_size - size < ALIGNMENT * 2) {
+        return;
+    }
+    bool prev_alloc = is_prev_allocated(block);
+    put_block(block, size, true);
+    set_prev_allocated(block, prev_alloc);
+
+    memory_block_t *tail = get_next_block(block);
+    put_block(tail, old_size - size - ALIGNMENT, false);
+    set_prev_allocated(tail, true);
+    STAT_ADD(splits, 1);
+    coalesce(tail);
+}
+
+/*
+ * aligned_gap - the distance from a free block's payload to the first payload
+ * aligned to alignment that leaves room for a free block before it.
+ */
+static size_t aligned_gap(memory_block_t *block, size_t alignment) {
+    size_t gap = -(size_t) get_payload(block) & (alignment - 1);
+    if (gap != 0 && gap < ALIGNMENT * 2) {
+        gap += alignment;
+    }
+    return gap;
+}
+
+/*
+ * find_aligned - finds a free block that can hold an aligned payload of size
+ * bytes. The lists that might hold one are searched first fit, and if none
+ * does, find() is asked for a block large enough for any alignment.
+ */
+static memory_block_t *find_aligned(size_t size, size_t alignment) {
+    size_t padded = size + alignment + ALIGNMENT * 2;
+    int fl, sl, last_fl, last_sl;
+    mapping_insert(size, &fl, &sl);
+    mapping_search(padded, &last_fl, &last_sl);
+    for (; fl <= last_fl && fl < FL_INDEX_COUNT; fl++, sl = 0) {
+        unsigned int sl_map = sl_bitmap[fl] & (~0U << sl);
+        if (fl == last_fl) {
+            sl_map &= (1U << last_sl) - 1;
+        }
+        for (; sl_map != 0; sl_map &= sl_map - 1) {
+            // the gap depends only on the address, so the slots answer it
+            fit_index_t *index = &fit_index[fl][__builtin_ctz(sl_map)];
+            for (int slot = 0; slot < index->count; slot++) {
+                memory_block_t *cur = index->blocks[slot];
+                if ((size_t) index->sizes[slot] * ALIGNMENT >= aligned_gap(cur, alignment) + size) {
+                    return cur;
+                }
+            }
+            memory_block_t *cur = seg_lists[fl][__builtin_ctz(sl_map)];
+            for (; index->unindexed > 0 && cur != NULL; cur = cur->next) {
+                if (!is_indexed(cur) && get_size(cur) >= aligned_gap(cur, alignment) + size) {
+                    return cur;
+                }
             }
-            prev->next = prev->next->next;
         }
-        num_free_blocks--;
-        assert(free_head->next == NULL || free_head < free_head->next);
+    }
+    return find(padded);
+}
+
+/*
+ * alloc_aligned_block - carves a block whose payload of at least size bytes
+ * is aligned to alignment out of a free block. The bytes before the payload
+ * stay free as a block of their own, and the bytes after it go back to the
+ * heap if they can hold a block. size must already be aligned.
+ */
+static memory_block_t *alloc_aligned_block(size_t size, size_t alignment) {
+    memory_block_t *block = find_aligned(size, alignment);
+    if (block == NULL) {
+        return NULL;
+    }
+    size_t gap = aligned_gap(block, alignment);
+    size_t total = get_size(block);
+    bool prev_alloc = is_prev_allocated(block);
+    remove_free_block(block);
+    if (gap > 0) {
+        put_block(block, gap - ALIGNMENT, false);
+        set_prev_allocated(block, prev_alloc);
+        put_footer(block);
+        insert_free_block(block);
+        block = (memory_block_t *) ((char *) block + gap);
+        total -= gap;
+        prev_alloc = false;
+    }
+    put_block(block, total, true);
+    set_prev_allocated(block, prev_alloc);
+    set_prev_allocated(get_next_block(block), true);
+    shrink_block(block, size);
+    claim_block(block);
+
+    return block;
+}
+
+/*
+ * trim_top - gives the end of a free block back to the OS with a negative
+ * csbrk, keeping pad bytes of its payload. Only the block right before the
+ * break can shrink, and only by whole pages. Returns the bytes released.
+ */
+static size_t trim_top(memory_block_t *block, size_t pad) {
+    if (get_next_block(block) != last_epilogue || (void *) (last_epilogue + 1) != heap_break()) {
+        return 0;
+    }
+    size_t size = get_size(block);
+    if (size <= pad) {
+        return 0;
+    }
+    size_t release = (size - pad) & ~(size_t) (PAGESIZE - 1);
+    if (release == 0) {
+        return 0;
+    }
 
-        return get_payload(result);
+    remove_free_block(block);
+    bool prev_alloc = is_prev_allocated(block);
+    if (release == size) {
+        // the whole block goes, its header becomes the epilogue
+        last_epilogue = block;
+    } else {
+        put_block(block, size - release, false);
+        set_prev_allocated(block, prev_alloc);
+        put_footer(block);
+        insert_free_block(block);
+        last_epilogue = get_next_block(block);
+        prev_alloc = false;
     }
-    // split the free block into an allocated and free block
-    // and return allocated payload address.
-    return split(result, size + ALIGNMENT);
+    put_block(last_epilogue, 0, true);
+    set_prev_allocated(last_epilogue, prev_alloc);
+    // the kernel keeps the rest of the page the break falls in, and hands it
+    // back as is when the heap grows again, so clear it for clean_start
+    char *brk_end = (char *) (last_epilogue + 1);
+    memset(brk_end, 0, (PAGESIZE - (size_t) brk_end % PAGESIZE) % PAGESIZE);
+    if (clean_start > (char *) last_epilogue) {
+        clean_start = (char *) last_epilogue;
+    }
+    heap_sbrk(-(intptr_t) release);
+    heap_size -= release;
+    STAT_SUB(heap_bytes, release);
+
+    return release;
 }
 
 /*
- * ufree -  frees the memory space pointed to by ptr, which must have been called
- * by a previous call to malloc.
+ * release_pages - releases the whole pages inside a free block with madvise,
+ * leaving its header, free list link and footer in place. The pages stay
+ * mapped and read back as zeros. Returns the bytes released.
  */
-void ufree(void *ptr) {
-    memory_block_t *new_free = (memory_block_t *) get_block(ptr);
-
-    if (is_allocated(new_free)) {
-        num_free_blocks++;
-        put_block(new_free, get_size(new_free), false);
-
-        memory_block_t *cur = free_head;
-        // update free list in increasing address order
-        if (new_free < free_head) {
-            memory_block_t *temp = free_head;
-            free_head = new_free;
-            new_free->next = temp;
+static size_t release_pages(memory_block_t *block) {
+    size_t page_mask = PAGESIZE - 1;
+    size_t start = ((size_t) get_payload(block) + sizeof(memory_block_t *) + page_mask) & ~page_mask;
+    size_t end = ((size_t) get_next_block(block) - sizeof(size_t)) & ~page_mask;
+    if (end <= start || madvise((void *) start, end - start, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    return end - start;
+}
+
+/*
+ * free_block - returns an allocated block to the heap, trimming the heap if
+ * the block ends up as a large free block at the top.
+ */
+static void free_block(memory_block_t *block) {
+    deallocate(block);
+    memory_block_t *merged = coalesce(block);
+    if (TRIM_THRESHOLD != 0 && get_size(merged) >= TRIM_THRESHOLD) {
+        trim_top(merged, TRIM_PAD);
+    }
+}
+
+/*
+ * slab_grow - gets a new page aligned page from csbrk for a slab run. The bytes
+ * needed to align the break are given to the heap when they can hold a block.
+ * Returns NULL if csbrk fails.
+ */
+static slab_run_t *slab_grow() {
+    size_t pad = (SLAB_RUN_SIZE - (size_t) heap_break() % SLAB_RUN_SIZE) % SLAB_RUN_SIZE;
+    size_t page = ((char *) heap_break() + pad - slab_map_base) / SLAB_RUN_SIZE;
+    if (page >= SLAB_MAP_PAGES) {
+        return NULL;
+    }
+    bool contiguous = last_epilogue != NULL && (void *) (last_epilogue + 1) == heap_break();
+    if (pad >= ALIGNMENT * 3 || (contiguous && pad >= ALIGNMENT * 2)) {
+        memory_block_t *padding = extend(pad - ALIGNMENT * 2);
+        if (padding == NULL) {
+            return NULL;
+        }
+        coalesce(padding);
+    } else if (pad > 0) {
+        void *padding = heap_sbrk(pad);
+        if (padding == NULL || padding == (void *) -1) {
+            return NULL;
+        }
+        STAT_ADD(heap_bytes, pad);
+    }
+    slab_run_t *run = (slab_run_t *) heap_sbrk(SLAB_RUN_SIZE);
+    if (run == NULL || run == (void *) -1) {
+        return NULL;
+    }
+    assert((size_t) run % SLAB_RUN_SIZE == 0);
+    STAT_ADD(heap_bytes, SLAB_RUN_SIZE);
+    // the page stays a run for as long as the heap lasts
+    slab_map[page / 64] |= 1UL << (page % 64);
+    slab_map_used = (page / 64 >= slab_map_used) ? page / 64 + 1 : slab_map_used;
+
+    return run;
+}
+
+/*
+ * slab_new_run - sets up an empty run of obj_size objects, reusing an empty
+ * page when there is one, and a page utrim released before growing the heap.
+ */
+static slab_run_t *slab_new_run(size_t obj_size) {
+    slab_run_t *run = slab_free_pages;
+    if (run != NULL) {
+        slab_free_pages = run->next;
+    } else if (num_slab_released > 0) {
+        run = slab_released[--num_slab_released];
+    } else {
+        run = slab_grow();
+        if (run == NULL) {
+            return NULL;
+        }
+    }
+    run->magic = SLAB_MAGIC ^ (size_t) run;
+    run->next = NULL;
+    run->prev = NULL;
+    run->obj_size = obj_size;
+    run->num_objs = (SLAB_RUN_SIZE - SLAB_HEADER_SIZE) / obj_size;
+    run->num_free = run->num_objs;
+    // bits past the last object are marked allocated so they are never used
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+        int first = word * 64;
+        if (first >= run->num_objs) {
+            run->bitmap[word] = ~0UL;
+        } else if (run->num_objs - first >= 64) {
+            run->bitmap[word] = 0;
         } else {
-            while (cur->next != NULL && cur->next < new_free) {
-                cur = cur->next;
-            }
-            new_free->next = cur->next;
-            cur->next = new_free;
+            run->bitmap[word] = ~0UL << (run->num_objs - first);
         }
+    }
 
-        coalesce(new_free);
+    return run;
+}
+
+/*
+ * slab_unlink - takes a run off the partial list of its size class.
+ */
+static void slab_unlink(slab_run_t *run) {
+    int slab_class = run->obj_size / ALIGNMENT - 1;
+    if (run->prev == NULL) {
+        slab_partial[slab_class] = run->next;
+    } else {
+        run->prev->next = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    run->next = NULL;
+    run->prev = NULL;
+}
+
+/*
+ * get_slab_run - returns the slab run holding a payload, or NULL if the payload
+ * belongs to an ordinary block. The slab map answers it without reading the
+ * payload's page.
+ */
+slab_run_t *get_slab_run(void *payload) {
+    assert(payload != NULL);
+    size_t page = ((char *) payload - slab_map_base) / SLAB_RUN_SIZE;
+    if (page >= slab_map_used * 64 || !(slab_map[page / 64] & (1UL << (page % 64)))) {
+        return NULL;
+    }
+    slab_run_t *run = (slab_run_t *) ((size_t) payload & ~(size_t) (SLAB_RUN_SIZE - 1));
+    assert(run->magic == (SLAB_MAGIC ^ (size_t) run));
+    return run;
+}
+
+/*
+ * slab_alloc - takes the first free object out of the first partial run of the
+ * size class. size must already be aligned and at most SLAB_MAX_SIZE. Returns
+ * NULL if there is no run with room and the heap cannot grow.
+ */
+void *slab_alloc(size_t size) {
+    int slab_class = size / ALIGNMENT - 1;
+    slab_run_t *run = slab_partial[slab_class];
+    if (run == NULL) {
+        run = slab_new_run(size);
+        if (run == NULL) {
+            return NULL;
+        }
+        slab_partial[slab_class] = run;
+    }
+
+    int word = 0;
+    while (run->bitmap[word] == ~0UL) {
+        word++;
+    }
+    int bit = __builtin_ctzl(~run->bitmap[word]);
+    run->bitmap[word] |= 1UL << bit;
+    run->num_free--;
+    // full runs leave the partial list until an object is freed
+    if (run->num_free == 0) {
+        slab_unlink(run);
+    }
+
+    return (char *) run + SLAB_HEADER_SIZE + (word * 64 + bit) * run->obj_size;
+}
+
+/*
+ * slab_free - returns an object to its run. A run that becomes empty goes to
+ * the empty page list for any size class to reuse, unless it is the last
+ * partial run of its own class.
+ */
+void slab_free(slab_run_t *run, void *payload) {
+    int slab_class = run->obj_size / ALIGNMENT - 1;
+    size_t index = ((char *) payload - (char *) run - SLAB_HEADER_SIZE) / run->obj_size;
+    assert(run->bitmap[index / 64] & (1UL << (index % 64)));
+    run->bitmap[index / 64] &= ~(1UL << (index % 64));
+
+    if (run->num_free == 0) {
+        // a full run has room again
+        run->next = slab_partial[slab_class];
+        if (run->next != NULL) {
+            run->next->prev = run;
+        }
+        slab_partial[slab_class] = run;
+    }
+    run->num_free++;
+
+    if (run->num_free == run->num_objs && (run->prev != NULL || run->next != NULL)) {
+        slab_unlink(run);
+        run->next = slab_free_pages;
+        slab_free_pages = run;
+    }
+}
+
+/*
+ * slab_release - gives the empty slab pages back to the OS with madvise and
+ * moves them to the released table, which slab_new_run takes from once the
+ * empty pages run out. A run is a single page, so its header goes too. Pages
+ * stay on the empty list if the table cannot grow. Returns the bytes released.
+ */
+static size_t slab_release() {
+    size_t released = 0;
+    while (slab_free_pages != NULL) {
+        if (num_slab_released == slab_released_capacity) {
+            size_t old_length = slab_released_capacity * sizeof(slab_run_t *);
+            size_t length = (old_length == 0) ? PAGESIZE : 2 * old_length;
+            slab_run_t **table = (old_length == 0)
+                ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                : mremap(slab_released, old_length, length, MREMAP_MAYMOVE);
+            if (table == MAP_FAILED) {
+                break;
+            }
+            slab_released = table;
+            slab_released_capacity = length / sizeof(slab_run_t *);
+        }
+        slab_run_t *run = slab_free_pages;
+        slab_run_t *next = run->next;
+        if (madvise(run, SLAB_RUN_SIZE, MADV_DONTNEED) != 0) {
+            break;
+        }
+        slab_free_pages = next;
+        slab_released[num_slab_released++] = run;
+        released += SLAB_RUN_SIZE;
+    }
+    return released;
+}
+
+/*
+ * get_large_block - gets the mapping that holds a mapped block.
+ */
+static large_block_t *get_large_block(memory_block_t *block) {
+    assert(is_mapped(block));
+    return (large_block_t *) ((char *) block - offsetof(large_block_t, block));
+}
+
+/*
+ * mapped_length - the number of bytes to map for a payload of size bytes,
+ * which its callers keep at most PTRDIFF_MAX so the sum cannot overflow.
+ */
+static size_t mapped_length(size_t size) {
+    return (size + sizeof(large_block_t) + PAGESIZE - 1) & ~(size_t) (PAGESIZE - 1);
+}
+
+/*
+ * mapping_offset - where a mapped block's header sits in its mapping. It is
+ * at the start, or at the end of the first page for payloads aligned to more
+ * than the header size.
+ */
+static size_t mapping_offset(large_block_t *large) {
+    return (size_t) large & (PAGESIZE - 1);
+}
+
+/*
+ * put_large_block - writes the header of a mapped block with length bytes from
+ * the header to the end of its mapping, and pushes it onto the list of mapped
+ * blocks. The payload gets the rest of the mapping.
+ */
+static memory_block_t *put_large_block(large_block_t *large, size_t length) {
+    put_block(&large->block, length - sizeof(large_block_t), true);
+    large->block.block_size_alloc |= MAPPED;
+    large->prev = NULL;
+    large->next = mapped_blocks;
+    if (mapped_blocks != NULL) {
+        mapped_blocks->prev = large;
+    }
+    mapped_blocks = large;
+    return &large->block;
+}
+
+/*
+ * unlink_large_block - takes a mapping off the list of mapped blocks.
+ */
+static void unlink_large_block(large_block_t *large) {
+    if (large->prev == NULL) {
+        mapped_blocks = large->next;
+    } else {
+        large->prev->next = large->next;
+    }
+    if (large->next != NULL) {
+        large->next->prev = large->prev;
+    }
+}
+
+/*
+ * map_block - maps a block for a large request on its own, since csbrk caps
+ * how far the heap can grow at once. The payload is aligned to alignment, at
+ * most PAGESIZE. Returns NULL if the mapping fails or size is past
+ * PTRDIFF_MAX.
+ */
+static memory_block_t *map_block(size_t size, size_t alignment) {
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    size_t offset = (alignment > sizeof(large_block_t)) ? PAGESIZE - sizeof(large_block_t) : 0;
+    size_t length = mapped_length(offset + size);
+    char *start = cmmap(length);
+    if (start == NULL) {
+        return NULL;
+    }
+    return put_large_block((large_block_t *) (start + offset), length - offset);
+}
+
+/*
+ * remap_block - resizes a mapped block to hold size bytes, letting the kernel
+ * move it if it cannot grow in place. Returns NULL, leaving the block as it
+ * was, if the mapping cannot be resized or size is past PTRDIFF_MAX.
+ */
+static memory_block_t *remap_block(memory_block_t *block, size_t size) {
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    large_block_t *large = get_large_block(block);
+    size_t offset = mapping_offset(large);
+    size_t old_length = offset + get_size(block) + sizeof(large_block_t);
+    size_t length = mapped_length(offset + size);
+    if (length == old_length) {
+        return block;
+    }
+    unlink_large_block(large);
+    char *moved = cmremap((char *) large - offset, old_length, length);
+    if (moved == NULL) {
+        put_large_block(large, old_length - offset);
+        return NULL;
+    }
+    // the header keeps its place in the first page, and so the alignment
+    return put_large_block((large_block_t *) (moved + offset), length - offset);
+}
+
+/*
+ * unmap_block - gives a mapped block back to the OS.
+ */
+static void unmap_block(memory_block_t *block) {
+    large_block_t *large = get_large_block(block);
+    size_t offset = mapping_offset(large);
+    unlink_large_block(large);
+    cmunmap((char *) large - offset, offset + get_size(block) + sizeof(large_block_t));
+}
+
+/*
+ * payload_size - the number of bytes usable at an allocated payload.
+ */
+static size_t payload_size(void *payload) {
+    slab_run_t *run = get_slab_run(payload);
+    if (run != NULL) {
+        return run->obj_size;
+    }
+    return get_size(get_block(payload));
+}
+
+/*
+ * count_alloc - counts a payload handed out through the interface, and
+ * returns it.
+ */
+static inline void *count_alloc(void *payload) {
+#ifdef UMALLOC_STATS
+    if (payload != NULL) {
+        STAT_ADD(allocs, 1);
+        STAT_ADD(bytes_live, payload_size(payload));
+    }
+#endif
+    return payload;
+}
+
+/*
+ * count_free - counts a payload given back through the interface.
+ */
+static inline void count_free(void *payload) {
+#ifdef UMALLOC_STATS
+    STAT_ADD(frees, 1);
+    STAT_SUB(bytes_live, payload_size(payload));
+#endif
+}
+
+/*
+ * alloc_payload - allocates an aligned size, from a slab run if it is small,
+ * from its own mapping if it is large, and from the heap otherwise.
+ */
+static void *alloc_payload(size_t size) {
+    if (size <= SLAB_MAX_SIZE) {
+        return slab_alloc(size);
+    }
+    memory_block_t *block = (size >= MMAP_THRESHOLD) ? map_block(size, ALIGNMENT) : alloc_block(size, NULL);
+    return (block == NULL) ? NULL : get_payload(block);
+}
+
+/*
+ * free_payload - frees a payload from a slab run, a mapping or the heap. Heap
+ * blocks that are not allocated are ignored.
+ */
+static void free_payload(void *payload) {
+    slab_run_t *run = get_slab_run(payload);
+    if (run != NULL) {
+        slab_free(run, payload);
+        return;
+    }
+    memory_block_t *block = get_block(payload);
+    if (is_mapped(block)) {
+        unmap_block(block);
+    } else if (is_allocated(block)) {
+        free_block(block);
+    }
+}
+
+#ifdef UMALLOC_THREADS
+/*
+ * Thread safe build. The heap itself is guarded by heap_lock, and every thread
+ * keeps a small cache of recently freed payloads per small size in front of it,
+ * so most small requests never take the lock. Cached payloads stay allocated in
+ * their slab run or on the heap and are linked through their first word. A
+ * payload may be freed by any thread: it simply lands in that thread's cache,
+ * and caches are flushed back to the heap when full and when their thread
+ * exits.
+ */
+#define TCACHE_BINS 16                              /* one bin per size up to 256B */
+#define TCACHE_MAX_SIZE (TCACHE_BINS * ALIGNMENT)
+#define TCACHE_MAX_COUNT 32                         /* payloads held per bin */
+#define TCACHE_FILL 8                               /* payloads taken per refill */
+
+typedef struct {
+    void *bins[TCACHE_BINS];
+    unsigned int counts[TCACHE_BINS];
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_once_t fork_handlers_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread tcache_t tcache;
+static __thread bool tcache_registered = false;
+
+/*
+ * tcache_flush - returns up to count payloads from a bin to the heap. The heap
+ * lock must be held.
+ */
+static void tcache_flush(tcache_t *cache, int bin, unsigned int count) {
+    while (count > 0 && cache->bins[bin] != NULL) {
+        void *payload = cache->bins[bin];
+        cache->bins[bin] = *(void **) payload;
+        cache->counts[bin]--;
+        free_payload(payload);
+        count--;
+    }
+}
+
+/*
+ * tcache_destroy - flushes a thread's whole cache when the thread exits.
+ */
+static void tcache_destroy(void *arg) {
+    tcache_t *cache = (tcache_t *) arg;
+    pthread_mutex_lock(&heap_lock);
+    for (int bin = 0; bin < TCACHE_BINS; bin++) {
+        tcache_flush(cache, bin, cache->counts[bin]);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * Fork handlers, so a child never starts with heap_lock held by a thread that
+ * was not copied into it.
+ */
+static void heap_lock_acquire() {
+    pthread_mutex_lock(&heap_lock);
+}
+
+static void heap_lock_release() {
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void register_fork_handlers() {
+    pthread_atfork(heap_lock_acquire, heap_lock_release, heap_lock_release);
+}
+
+static void tcache_create_key() {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ * tcache_push - caches an allocated payload of a cacheable size. Returns false
+ * if its bin is already full.
+ */
+static bool tcache_push(void *payload, size_t size) {
+    int bin = size / ALIGNMENT - 1;
+    if (tcache.counts[bin] >= TCACHE_MAX_COUNT) {
+        return false;
+    }
+    if (!tcache_registered) {
+        // have the cache flushed when this thread exits
+        pthread_once(&tcache_key_once, tcache_create_key);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache_registered = true;
+    }
+    *(void **) payload = tcache.bins[bin];
+    tcache.bins[bin] = payload;
+    tcache.counts[bin]++;
+    return true;
+}
+
+/*
+ * tcache_alloc - serves a request from this thread's cache, or from the heap
+ * under the lock. A miss on a small size takes a few extra payloads of that
+ * size while the lock is held.
+ */
+static void *tcache_alloc(size_t size) {
+    int bin = size / ALIGNMENT - 1;
+    if (size <= TCACHE_MAX_SIZE && tcache.bins[bin] != NULL) {
+        void *payload = tcache.bins[bin];
+        tcache.bins[bin] = *(void **) payload;
+        tcache.counts[bin]--;
+        return payload;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    void *result = alloc_payload(size);
+    if (result != NULL && size <= TCACHE_MAX_SIZE) {
+        for (int i = 1; i < TCACHE_FILL; i++) {
+            void *extra = alloc_payload(size);
+            if (extra == NULL) {
+                break;
+            }
+            // blocks handed out whole may be larger than size
+            if (payload_size(extra) != size || !tcache_push(extra, size)) {
+                free_payload(extra);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    return result;
+}
+
+/*
+ * tcache_free - puts a freed payload in this thread's cache, or returns it to
+ * the heap under the lock. A full bin is half flushed so the next frees of
+ * that size stay lock free.
+ */
+static void tcache_free(void *payload) {
+    slab_run_t *run = get_slab_run(payload);
+    if (run == NULL && !is_allocated(get_block(payload))) {
+        return;
+    }
+    size_t size = payload_size(payload);
+    if (size <= TCACHE_MAX_SIZE && tcache_push(payload, size)) {
+        return;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    if (size <= TCACHE_MAX_SIZE) {
+        tcache_flush(&tcache, size / ALIGNMENT - 1, TCACHE_MAX_COUNT / 2);
+    }
+    free_payload(payload);
+    pthread_mutex_unlock(&heap_lock);
+}
+#endif
+
+/*
+ * uinit - Used to initialize metadata required to manage the heap
+ * along with allocating initial memory.
+ */
+int uinit() {
+    fl_bitmap = 0;
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            // an empty list's index is already clear
+            if (sl_bitmap[fl] & (1U << sl)) {
+                fit_index_t *index = &fit_index[fl][sl];
+                memset(index->sizes, 0, index->count * sizeof(index->sizes[0]));
+                index->count = 0;
+                index->unindexed = 0;
+            }
+            seg_lists[fl][sl] = NULL;
+        }
+        sl_bitmap[fl] = 0;
+    }
+    for (int slab_class = 0; slab_class < SLAB_CLASSES; slab_class++) {
+        slab_partial[slab_class] = NULL;
+    }
+    slab_free_pages = NULL;
+    num_slab_released = 0;
+    if (slab_map == NULL) {
+        slab_map = mmap(NULL, SLAB_MAP_PAGES / 8, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (slab_map == MAP_FAILED) {
+            slab_map = NULL;
+            return -1;
+        }
+    }
+    memset(slab_map, 0, slab_map_used * sizeof(uint64_t));
+    slab_map_used = 0;
+    // the heap never shrinks below where it starts
+    slab_map_base = (char *) ((size_t) heap_break() & ~(size_t) (SLAB_RUN_SIZE - 1));
+    mapped_blocks = NULL;
+    num_free_blocks = 0;
+    heap_size = 0;
+    heap_allocs = 0;
+    last_growth = 0;
+    growth_step = GROWTH_GRANULE;
+#ifdef UMALLOC_STATS
+    memset(&counted, 0, sizeof(counted));
+#endif
+    last_epilogue = NULL;
+    // put initial heap size to 8192B + hidden 16 for header
+    memory_block_t *initial = extend(PAGESIZE * 2);
+    // check for errors
+    if (initial == NULL || get_size(initial) != PAGESIZE * 2 || heap_size != PAGESIZE * 2) {
+        return -1;
+    }
+    insert_free_block(initial);
+#ifdef UMALLOC_THREADS
+    pthread_once(&fork_handlers_once, register_fork_handlers);
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * Returns NULL for sizes past PTRDIFF_MAX, which no heap or mapping can hold.
+ */
+void *umalloc(size_t size) {
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    // align
+    if (size % ALIGNMENT != 0) {
+        size += ALIGNMENT - (size % ALIGNMENT);
+    }
+    // leave room for a footer once the block is freed
+    if (size < ALIGNMENT) {
+        size = ALIGNMENT;
+    }
+#ifdef UMALLOC_THREADS
+    return count_alloc(tcache_alloc(size));
+#else
+    return count_alloc(alloc_payload(size));
+#endif
+}
+
+/*
+ * ufree -  frees the memory space pointed to by ptr, which must have been called
+ * by a previous call to malloc.
+ */
+void ufree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    count_free(ptr);
+#ifdef UMALLOC_THREADS
+    tcache_free(ptr);
+#else
+    free_payload(ptr);
+#endif
+}
+
+/*
+ * umalloc_usable_size - returns the number of bytes usable at ptr, which is at
+ * least the size it was allocated with, or 0 for NULL.
+ */
+size_t umalloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return payload_size(ptr);
+}
+
+/*
+ * ucalloc - allocates an array of nmemb elements of size bytes, all zeroed.
+ * Returns NULL if the total size overflows. Only the part of a heap block that
+ * has been handed out before is cleared; memory fresh from csbrk or a new
+ * mapping already reads as zeros.
+ */
+void *ucalloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total) || total > PTRDIFF_MAX) {
+        return NULL;
+    }
+    if (total <= SLAB_MAX_SIZE) {
+        void *ptr = umalloc(total);
+        if (ptr != NULL) {
+            memset(ptr, 0, payload_size(ptr));
+        }
+        return ptr;
+    }
+
+    size = ALIGN(total);
+    size_t dirty = 0;
+#ifdef UMALLOC_THREADS
+    pthread_mutex_lock(&heap_lock);
+#endif
+    memory_block_t *block = (size >= MMAP_THRESHOLD) ? map_block(size, ALIGNMENT) : alloc_block(size, &dirty);
+#ifdef UMALLOC_THREADS
+    pthread_mutex_unlock(&heap_lock);
+#endif
+    if (block == NULL) {
+        return NULL;
+    }
+    memset(get_payload(block), 0, dirty);
+
+    return count_alloc(get_payload(block));
+}
+
+/*
+ * ualigned_alloc - allocates size bytes at an address that is a multiple of
+ * alignment, a power of two of at most PAGESIZE. Returns NULL for any other
+ * alignment. The payload is carved out of a free block where the alignment
+ * falls, and the bytes around it stay free.
+ */
+void *ualigned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > PAGESIZE ||
+        size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return umalloc(size);
+    }
+    size = (size < ALIGNMENT) ? ALIGNMENT : ALIGN(size);
+
+#ifdef UMALLOC_THREADS
+    pthread_mutex_lock(&heap_lock);
+#endif
+    memory_block_t *block = (size >= MMAP_THRESHOLD) ? map_block(size, alignment) : alloc_aligned_block(size, alignment);
+#ifdef UMALLOC_THREADS
+    pthread_mutex_unlock(&heap_lock);
+#endif
+
+    return (block == NULL) ? NULL : count_alloc(get_payload(block));
+}
+
+/*
+ * resize_block - tries to resize an allocated block to size bytes of payload
+ * without moving it. Shrinking always works. Growing absorbs the free block
+ * after it, first extending the heap when the block sits at the end of the
+ * most recent chunk, unless size is large enough to be mapped. Returns false
+ * if the block has to move.
+ */
+static bool resize_block(memory_block_t *block, size_t size) {
+    memory_block_t *next = get_next_block(block);
+    size_t available = get_size(block);
+    if (!is_allocated(next)) {
+        available += get_size(next) + ALIGNMENT;
+    }
+
+    // grow the wilderness while the new memory stays contiguous
+    bool at_end = next == last_epilogue || (!is_allocated(next) && get_next_block(next) == last_epilogue);
+    while (at_end && available < size && size < MMAP_THRESHOLD) {
+        memory_block_t *old_epilogue = last_epilogue;
+        memory_block_t *more = extend(round_growth(size - available));
+        if (more == NULL) {
+            break;
+        }
+        coalesce(more);
+        if (more != old_epilogue) {
+            break;
+        }
+        next = get_next_block(block);
+        available = get_size(block) + get_size(next) + ALIGNMENT;
+    }
+
+    if (available < size) {
+        return false;
+    }
+    if (available > get_size(block)) {
+        // absorb the free block after this one
+        remove_free_block(next);
+        bool prev_alloc = is_prev_allocated(block);
+        put_block(block, available, true);
+        set_prev_allocated(block, prev_alloc);
+        set_prev_allocated(get_next_block(block), true);
+        claim_block(block);
+    }
+    shrink_block(block, size);
+
+    return true;
+}
+
+/*
+ * urealloc - changes the size of the allocation at ptr to size bytes, keeping
+ * its contents. The block is resized in place when possible, and only copied
+ * to a new block as a last resort. Slab objects stay put while the new size
+ * fits their size class, and mapped blocks are remapped while they stay large.
+ * Sizes past PTRDIFF_MAX return NULL and leave ptr as it was.
+ */
+void *urealloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return umalloc(size);
+    }
+    if (size == 0) {
+        ufree(ptr);
+        return NULL;
+    }
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    // align
+    size_t new_size = size;
+    if (new_size % ALIGNMENT != 0) {
+        new_size += ALIGNMENT - (new_size % ALIGNMENT);
+    }
+    if (new_size < ALIGNMENT) {
+        new_size = ALIGNMENT;
+    }
+
+    size_t old_size = payload_size(ptr);
+    memory_block_t *block = get_block(ptr);
+    STAT_ADD(reallocs, 1);
+    if (get_slab_run(ptr) != NULL) {
+        if (new_size <= old_size) {
+            return ptr;
+        }
+    } else if (is_mapped(block)) {
+        if (new_size >= MMAP_THRESHOLD) {
+#ifdef UMALLOC_THREADS
+            pthread_mutex_lock(&heap_lock);
+#endif
+            memory_block_t *moved = remap_block(block, new_size);
+#ifdef UMALLOC_THREADS
+            pthread_mutex_unlock(&heap_lock);
+#endif
+            if (moved != NULL) {
+                STAT_ADD(bytes_live, get_size(moved) - old_size);
+                return get_payload(moved);
+            }
+        }
+    } else {
+        assert(is_allocated(block));
+#ifdef UMALLOC_THREADS
+        pthread_mutex_lock(&heap_lock);
+#endif
+        bool resized = resize_block(block, new_size);
+#ifdef UMALLOC_THREADS
+        pthread_mutex_unlock(&heap_lock);
+#endif
+        if (resized) {
+            STAT_ADD(bytes_live, get_size(block) - old_size);
+            return ptr;
+        }
+    }
+
+    // last resort, move the payload to a new block
+    void *new_ptr = umalloc(size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+    ufree(ptr);
+
+    return new_ptr;
+}
+
+/*
+ * utrim - gives as much free memory back to the OS as possible, like
+ * malloc_trim. The free block at the top of the heap is cut down to pad bytes,
+ * and the whole pages inside every other free block and the empty slab pages
+ * are released with madvise. Returns 1 if any memory was released, 0
+ * otherwise.
+ */
+int utrim(size_t pad) {
+    size_t released = 0;
+#ifdef UMALLOC_THREADS
+    pthread_mutex_lock(&heap_lock);
+#endif
+    if (last_epilogue != NULL && !is_prev_allocated(last_epilogue)) {
+        released += trim_top(get_prev_block(last_epilogue), ALIGN(pad));
+    }
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            for (memory_block_t *cur = seg_lists[fl][sl]; cur != NULL; cur = cur->next) {
+                released += release_pages(cur);
+            }
+        }
+    }
+    released += slab_release();
+#ifdef UMALLOC_THREADS
+    pthread_mutex_unlock(&heap_lock);
+#endif
+
+    return released > 0;
+}
+
+/*
+ * arena_map - maps a segment for an arena with room for size bytes of payload
+ * after reserve bytes kept for the caller. Returns NULL if the mapping fails.
+ */
+static arena_segment_t *arena_map(size_t size, size_t reserve) {
+    size_t header = ALIGN(sizeof(arena_segment_t) + reserve);
+    size_t length = (header + size + PAGESIZE - 1) & ~(size_t) (PAGESIZE - 1);
+    length = (length > ARENA_SEGMENT_SIZE) ? length : ARENA_SEGMENT_SIZE;
+    arena_segment_t *segment = cmmap(length);
+    if (segment == NULL) {
+        return NULL;
+    }
+    segment->next = NULL;
+    segment->length = length;
+    segment->start = (char *) segment + header;
+
+    return segment;
+}
+
+static char *segment_end(arena_segment_t *segment) {
+    return (char *) segment + segment->length;
+}
+
+/*
+ * arena_grow - makes a segment with room for size bytes the newest one of an
+ * arena, taking the first spare segment that is large enough and mapping a
+ * new one if none is. Returns false if the mapping fails.
+ */
+static bool arena_grow(uarena_t *arena, size_t size) {
+    arena_segment_t **link = &arena->spare;
+    while (*link != NULL && (size_t) (segment_end(*link) - (*link)->start) < size) {
+        link = &(*link)->next;
+    }
+    arena_segment_t *segment = *link;
+    if (segment != NULL) {
+        *link = segment->next;
+    } else {
+        segment = arena_map(size, 0);
+        if (segment == NULL) {
+            return false;
+        }
+    }
+    segment->next = arena->segments;
+    arena->segments = segment;
+    if (arena->oldest == NULL) {
+        arena->oldest = segment;
+    }
+    arena->top = segment->start;
+
+    return true;
+}
+
+/*
+ * uarena_create - makes an empty arena. The arena itself lives at the start of
+ * its first segment. Returns NULL if the mapping fails.
+ */
+uarena_t *uarena_create(void) {
+    arena_segment_t *segment = arena_map(0, sizeof(uarena_t));
+    if (segment == NULL) {
+        return NULL;
+    }
+    uarena_t *arena = (uarena_t *) (segment + 1);
+    arena->segments = segment;
+    arena->oldest = segment;
+    arena->spare = NULL;
+    arena->top = segment->start;
+    arena->last = NULL;
+
+    return arena;
+}
+
+/*
+ * uarena_malloc - allocates size bytes from an arena, or from the umalloc
+ * heap if arena is NULL.
+ */
+void *uarena_malloc(uarena_t *arena, size_t size) {
+    if (arena == NULL) {
+        return umalloc(size);
+    }
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    size = (size < ALIGNMENT) ? ALIGNMENT : ALIGN(size);
+    if (arena->segments == NULL || (size_t) (segment_end(arena->segments) - arena->top) < size) {
+        if (!arena_grow(arena, size)) {
+            return NULL;
+        }
+    }
+    arena->last = arena->top;
+    arena->top += size;
+
+    return arena->last;
+}
+
+/*
+ * uarena_free - frees a payload of the umalloc heap if arena is NULL. In an
+ * arena only the latest payload is given back, so a short lived one can be
+ * undone; any other waits for the next reset.
+ */
+void uarena_free(uarena_t *arena, void *ptr) {
+    if (arena == NULL) {
+        ufree(ptr);
+        return;
+    }
+    if (ptr != NULL && ptr == arena->last) {
+        arena->top = arena->last;
+        arena->last = NULL;
+    }
+}
+
+/*
+ * uarena_reset - releases every payload of an arena at once. The segments in
+ * use are moved whole onto the spare list, so the next round reuses them
+ * without mapping anything.
+ */
+void uarena_reset(uarena_t *arena) {
+    if (arena->segments != NULL) {
+        arena->oldest->next = arena->spare;
+        arena->spare = arena->segments;
+        arena->segments = NULL;
+        arena->oldest = NULL;
+    }
+    arena->top = NULL;
+    arena->last = NULL;
+}
+
+/*
+ * uarena_destroy - unmaps every segment of an arena, the one holding the
+ * arena itself last.
+ */
+void uarena_destroy(uarena_t *arena) {
+    arena_segment_t *own = (arena_segment_t *) arena - 1;
+    uarena_reset(arena);
+    for (arena_segment_t *segment = arena->spare; segment != NULL;) {
+        arena_segment_t *next = segment->next;
+        if (segment != own) {
+            cmunmap(segment, segment->length);
+        }
+        segment = next;
+    }
+    cmunmap(own, own->length);
+}
+
+/*
+ * ustats - fills in stats. The free blocks, the mapped blocks and the
+ * residency of the huge page heap are measured now; the counters are copied
+ * from the running totals kept with UMALLOC_STATS.
+ */
+void ustats(ustats_t *stats) {
+#ifdef UMALLOC_THREADS
+    pthread_mutex_lock(&heap_lock);
+#endif
+#ifdef UMALLOC_STATS
+    *stats = counted;
+    stats->counting = true;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            for (memory_block_t *cur = seg_lists[fl][sl]; cur != NULL; cur = cur->next) {
+                size_t size = get_size(cur);
+                int bucket = 63 - __builtin_clzl(size) - 4;
+                stats->free_blocks++;
+                stats->free_bytes += size;
+                stats->largest_free = (size > stats->largest_free) ? size : stats->largest_free;
+                stats->free_histogram[(bucket < USTATS_BUCKETS) ? bucket : USTATS_BUCKETS - 1]++;
+            }
+        }
+    }
+    for (large_block_t *large = mapped_blocks; large != NULL; large = large->next) {
+        stats->mapped_blocks++;
+        stats->mapped_bytes += mapping_offset(large) + get_size(&large->block) + sizeof(large_block_t);
+    }
+#ifdef UMALLOC_THREADS
+    pthread_mutex_unlock(&heap_lock);
+#endif
+#ifdef UMALLOC_HUGE
+    chsbrk_residency(&stats->huge_resident, &stats->huge_bytes);
+#endif
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double) stats->largest_free / stats->free_bytes;
+    }
+}
+
+/*
+ * ustats_print - prints ustats() to out, one line per figure.
+ */
+void ustats_print(FILE *out) {
+    ustats_t stats;
+    ustats(&stats);
+    fprintf(out, "free blocks:        %zu, %zu bytes, largest %zu\n",
+            stats.free_blocks, stats.free_bytes, stats.largest_free);
+    fprintf(out, "fragmentation:      %.4f\n", stats.fragmentation);
+    fprintf(out, "free block sizes:  ");
+    for (int bucket = 0; bucket < USTATS_BUCKETS; bucket++) {
+        if (stats.free_histogram[bucket] != 0) {
+            fprintf(out, " %zu%s:%zu", (size_t) ALIGNMENT << bucket,
+                    (bucket == USTATS_BUCKETS - 1) ? "+" : "", stats.free_histogram[bucket]);
+        }
+    }
+    fprintf(out, "\n");
+    fprintf(out, "mapped blocks:      %zu, %zu bytes\n", stats.mapped_blocks, stats.mapped_bytes);
+#ifdef UMALLOC_HUGE
+    fprintf(out, "huge page hit rate: %.1f%%, %zu of %zu resident bytes\n",
+            stats.huge_resident ? 100.0 * stats.huge_bytes / stats.huge_resident : 0.0,
+            stats.huge_bytes, stats.huge_resident);
+#endif
+    if (!stats.counting) {
+        fprintf(out, "counters:           off, build with make STATS=1\n");
+        return;
     }
-    assert(free_head->next == NULL || free_head < free_head->next);
+    fprintf(out, "allocs/frees:       %zu/%zu, %zu reallocs\n", stats.allocs, stats.frees, stats.reallocs);
+    fprintf(out, "bytes live/held:    %zu/%zu\n", stats.bytes_live, stats.heap_bytes + stats.mapped_bytes);
+    fprintf(out, "find visits:        %.2f avg, %zu max over %zu finds\n",
+            stats.finds ? (double) stats.find_visits / stats.finds : 0.0, stats.find_max_visits, stats.finds);
+    fprintf(out, "splits/coalesces:   %zu/%zu\n", stats.splits, stats.coalesces);
+    fprintf(out, "extends:            %zu\n", stats.extends);
 }
@@ -2,41 +2,240 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <string.h>
+#include <stdint.h>
 
 #define ALIGNMENT 16 /* The alignment of all payloads returned by umalloc */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
+/*
+ * Segregated free lists, indexed in two levels (TLSF). The first level splits
+ * sizes by power of two, the second splits each power of two into
+ * SL_INDEX_COUNT equal ranges. Sizes below SMALL_BLOCK_SIZE all share first
+ * level 0 and are split into exact ALIGNMENT-sized classes.
+ */
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + 4)
+#define FL_INDEX_MAX 32 /* free blocks up to 4 GiB */
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+
+#define PREV_ALLOC 0x2 /* block_size_alloc bit for an allocated neighbour */
+#define MAPPED 0x4     /* block_size_alloc bit for a block mapped outside the heap */
+#define INDEXED 0x8    /* block_size_alloc bit for a free block in its list's fit index */
+
+/*
+ * Each segregated list mirrors the sizes of up to FIT_INDEX_SLOTS of its blocks
+ * in a fit index, packed together so a fit search compares them a vector at a
+ * time instead of following next links through the heap. Sizes are stored in
+ * ALIGNMENT units, and unused slots hold 0. Blocks that do not fit in the slots
+ * are only reachable through the list.
+ */
+#define FIT_INDEX_SLOTS 16
+
+/*
+ * Requests of at least MMAP_THRESHOLD bytes are mapped on their own instead of
+ * carved from the heap. A mapped block has the usual header, preceded by the
+ * links of the list of all mapped blocks.
+ */
+#define MMAP_THRESHOLD (32 * 1024)
+
+/*
+ * When a free block at the top of the heap, next to the break, grows past
+ * TRIM_THRESHOLD bytes, all but TRIM_PAD bytes of it are given back with a
+ * negative csbrk. A threshold of 0 turns automatic trimming off; utrim() still
+ * works.
+ */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128 * 1024)
+#endif
+#define TRIM_PAD (TRIM_THRESHOLD / 4)
+
+/*
+ * When no free block fits, the heap grows by only what the request is short
+ * of, counting the free block at the top of the heap when the new memory
+ * directly follows it. GROWTH_POLICY says how much more to add on top:
+ * GROWTH_FIXED adds nothing, GROWTH_GEOMETRIC grows by at least the heap size,
+ * doubling it, and GROWTH_ADAPTIVE grows by at least a step that doubles while
+ * growths come within GROWTH_WINDOW heap allocations of each other and halves
+ * otherwise. Every growth is rounded up to GROWTH_GRANULE bytes of csbrk.
+ */
+#define GROWTH_FIXED 0
+#define GROWTH_GEOMETRIC 1
+#define GROWTH_ADAPTIVE 2
+#ifndef GROWTH_POLICY
+#define GROWTH_POLICY GROWTH_ADAPTIVE
+#endif
+#ifndef GROWTH_GRANULE
+#define GROWTH_GRANULE 1024
+#endif
+#define GROWTH_WINDOW 64
+
+/*
+ * Requests of up to SLAB_MAX_SIZE bytes are served from slab runs: page sized,
+ * page aligned runs of equal sized objects with no per-object header. The run
+ * header at the start of the page holds the object size and an occupancy
+ * bitmap, so a payload's run is found by rounding its address down. Whether
+ * a page is a run at all is kept in a bitmap apart from the heap, since the
+ * first word of any other page may be user data.
+ */
+#define SLAB_CLASSES 8 /* one size class per ALIGNMENT step */
+#define SLAB_MAX_SIZE (SLAB_CLASSES * ALIGNMENT)
+#define SLAB_RUN_SIZE 4096
+#define SLAB_BITMAP_WORDS (SLAB_RUN_SIZE / ALIGNMENT / 64)
+#define SLAB_HEADER_SIZE ALIGN(sizeof(slab_run_t))
+#define SLAB_MAGIC 0x51ab51ab51ab51abUL
+
+typedef struct slab_run_struct {
+    size_t magic;                       /* SLAB_MAGIC ^ the address of the run, checked by asserts */
+    struct slab_run_struct *next;       /* partial list, or empty page list */
+    struct slab_run_struct *prev;
+    unsigned int obj_size;
+    unsigned int num_objs;
+    unsigned int num_free;
+    uint64_t bitmap[SLAB_BITMAP_WORDS]; /* set bits are allocated objects */
+} slab_run_t;
+
 /*
  * memory_block_t - Represents a block of memory managed by the heap.
  * The struct can be left as is, or modified for your design.
  * In the current design bit0 is the allocated bit
- * bits 1-3 are unused
+ * bit1 is set when the block directly before it in memory is allocated
+ * bit2 is set for blocks mapped outside the heap
+ * bit3 is set for free blocks in their list's fit index
  * and the remaining 60 bits represent the size.
+ * Free blocks repeat their size in a footer, the last word of the payload, so
+ * the block after them can find them by address arithmetic. The first word of
+ * a free block's payload links back to the previous block in its free list.
  */
 typedef struct memory_block_struct {
     size_t block_size_alloc;
     struct memory_block_struct *next;
 } memory_block_t;
 
+typedef struct {
+    int32_t sizes[FIT_INDEX_SLOTS];             /* block sizes / ALIGNMENT */
+    memory_block_t *blocks[FIT_INDEX_SLOTS];
+    unsigned int count;                         /* slots in use */
+    unsigned int unindexed;                     /* blocks in the list but not the slots */
+} fit_index_t;
+
+typedef struct large_block_struct {
+    struct large_block_struct *next;    /* list of mapped blocks */
+    struct large_block_struct *prev;
+    memory_block_t block;               /* header, marked allocated and MAPPED */
+} large_block_t;
+
+/*
+ * An arena hands out payloads from its own mapped segments, of at least
+ * ARENA_SEGMENT_SIZE bytes each, by bumping a pointer through the newest one,
+ * so its payloads carry no header. Payloads are not freed one by one:
+ * uarena_reset releases all of them at once and keeps the segments for the
+ * next round, and uarena_destroy unmaps them. An arena is not locked, so only
+ * one thread at a time may use it. A NULL arena stands for the umalloc heap.
+ */
+#define ARENA_SEGMENT_SIZE (64 * 1024)
+
+typedef struct arena_segment_struct {
+    struct arena_segment_struct *next;
+    size_t length;                      /* of the whole mapping */
+    char *start;                        /* first payload byte */
+} arena_segment_t;
+
+typedef struct {
+    arena_segment_t *segments;          /* in use, newest first */
+    arena_segment_t *oldest;            /* the last one in segments */
+    arena_segment_t *spare;             /* emptied by a reset, reused before mapping more */
+    char *top;                          /* next free byte of the newest segment */
+    char *last;                         /* the latest payload, which uarena_free takes back */
+} uarena_t;
+
+/*
+ * Allocator statistics, filled in by ustats(). The counters, from allocs down,
+ * are only kept when umalloc is built with UMALLOC_STATS (make STATS=1), and
+ * read 0 otherwise so the hot paths pay nothing for them. The rest is measured
+ * from the free lists and mapped blocks on each call.
+ */
+#define USTATS_BUCKETS 16 /* free block sizes from 16B up, by power of two */
+
+typedef struct {
+    bool counting;              /* built with UMALLOC_STATS */
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t largest_free;
+    double fragmentation;       /* 1 - largest_free / free_bytes */
+    size_t free_histogram[USTATS_BUCKETS]; /* bucket i holds sizes in [16 << i, 32 << i) */
+    size_t mapped_blocks;
+    size_t mapped_bytes;
+    size_t huge_resident;       /* resident bytes of the huge page heap, UMALLOC_HUGE only */
+    size_t huge_bytes;          /* how many of them are in huge pages */
+    size_t allocs;
+    size_t frees;
+    size_t reallocs;            /* a realloc that moves also counts an alloc and a free */
+    size_t bytes_live;          /* usable bytes of the payloads handed out */
+    size_t heap_bytes;          /* bytes held from csbrk, heap and slab runs */
+    size_t finds;
+    size_t find_visits;         /* free blocks looked at, over every find */
+    size_t find_max_visits;
+    size_t splits;
+    size_t coalesces;           /* merges with a neighbour */
+    size_t extends;
+} ustats_t;
+
 // Helper Functions, this may be editted if you change the signature in umalloc.c
 bool is_allocated(memory_block_t *block);
 void allocate(memory_block_t *block);
 void deallocate(memory_block_t *block);
 size_t get_size(memory_block_t *block);
 memory_block_t *get_next(memory_block_t *block);
+memory_block_t *get_prev(memory_block_t *block);
+void set_prev(memory_block_t *block, memory_block_t *prev);
 void put_block(memory_block_t *block, size_t size, bool alloc);
 void *get_payload(memory_block_t *block);
 memory_block_t *get_block(void *payload);
+bool is_prev_allocated(memory_block_t *block);
+void set_prev_allocated(memory_block_t *block, bool prev_alloc);
+bool is_mapped(memory_block_t *block);
+void put_footer(memory_block_t *block);
+memory_block_t *get_next_block(memory_block_t *block);
+memory_block_t *get_prev_block(memory_block_t *block);
+
+// segregated list helpers
+void mapping_insert(size_t size, int *fl, int *sl);
+void mapping_search(size_t size, int *fl, int *sl);
+void insert_free_block(memory_block_t *block);
+void remove_free_block(memory_block_t *block);
+bool is_indexed(memory_block_t *block);
+
+// slab helpers
+slab_run_t *get_slab_run(void *payload);
+void *slab_alloc(size_t size);
+void slab_free(slab_run_t *run, void *payload);
 
 memory_block_t *find(size_t size);
 memory_block_t *extend(size_t size);
 memory_block_t *split(memory_block_t *block, size_t size);
 // added as split helper method
 void update_list(memory_block_t *old_block, memory_block_t *new_free_block);
-void coalesce(memory_block_t *block);
+memory_block_t *coalesce(memory_block_t *block);
 
 
 // Portion that may not be edited
 int uinit();
 void *umalloc(size_t size);
 void ufree(void *ptr);
+
+// Additions to the interface
+void *urealloc(void *ptr, size_t size);
+int utrim(size_t pad);
+size_t umalloc_usable_size(void *ptr);
+void *ucalloc(size_t nmemb, size_t size);
+void *ualigned_alloc(size_t alignment, size_t size);
+uarena_t *uarena_create(void);
+void *uarena_malloc(uarena_t *arena, size_t size);
+void uarena_free(uarena_t *arena, void *ptr);
+void uarena_reset(uarena_t *arena);
+void uarena_destroy(uarena_t *arena);
+void ustats(ustats_t *stats);
+void ustats_print(FILE *out);